@@ -158,7 +158,9 @@ void Core::ImageLocator::load() {
             if (!network) {
                 network=new NetworkAccessManager(this);
             }
-            Job *job=new Job(network->get(i.details.url), i.size);
+            QNetworkRequest req(i.details.url);
+            req.setPriority(QNetworkRequest::LowPriority);
+            Job *job=new Job(network->get(req), i.size);
             job->sizes.insert(0);
             connect(job->netJob, SIGNAL(finished()), this, SLOT(jobFinished()));
             jobs.insert(i.details, job);
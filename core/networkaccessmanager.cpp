@@ -22,6 +22,7 @@
  */
 
 #include "core/networkaccessmanager.h"
+#include "core/configuration.h"
 #include "core/globalstatic.h"
 #include "core/debug.h"
 #include <QTimerEvent>
@@ -36,6 +37,8 @@ class NoRedirectNetworkJob : public NetworkJob {
 public:
     NoRedirectNetworkJob(QNetworkReply *j)
         : NetworkJob(j) { }
+    NoRedirectNetworkJob(QObject *parent, const QUrl &u)
+        : NetworkJob(parent, u) { }
     virtual ~NoRedirectNetworkJob() { }
     virtual int maxRedirects() const { return 0; }
 };
@@ -54,6 +57,18 @@ Core::NetworkJob::NetworkJob(QNetworkReply *j)
     DBUG(Network) << (void *)this << (void *)job << origU;
 }
 
+// Job is started later, via setJob(), when a connection to the host is available
+Core::NetworkJob::NetworkJob(QObject *parent, const QUrl &u)
+    : QObject(parent)
+    , maxRedir(5)
+    , numRedirects(0)
+    , lastDownloadPc(0)
+    , job(0)
+    , origU(u)
+{
+    DBUG(Network) << (void *)this << origU;
+}
+
 Core::NetworkJob::~NetworkJob() {
     DBUG(Network) << (void *)this << (void *)job << origU;
     cancelJob();
@@ -65,6 +80,11 @@ void Core::NetworkJob::cancelAndDelete() {
     deleteLater();
 }
 
+void Core::NetworkJob::setJob(QNetworkReply *j) {
+    job=j;
+    connectJob();
+}
+
 void Core::NetworkJob::connectJob() {
     if (!job) {
         return;
@@ -160,30 +180,43 @@ void Core::NetworkJob::handleReadyRead() {
 
 GLOBAL_STATIC(Core::NetworkAccessManager, instance)
 
+static const int constMaxPerHost=4;
+static const int constIdleTimeout=30000; // Close idle connections after this many ms
+
+static QString hostKey(const QUrl &url) {
+    return url.host()+QLatin1Char(':')+QString::number(url.port(80));
+}
+
 Core::NetworkAccessManager::NetworkAccessManager(QObject *parent)
     : QNetworkAccessManager(parent)
+    , idleTimer(new QTimer(this))
+    , numRequests(0)
+    , numReused(0)
 {
+    Configuration cfg(this);
+    maxPerHost=cfg.get("maxPerHost", constMaxPerHost, 1, 6);
+    foreach (const QString &host, cfg.get("noKeepAlive", QStringList())) {
+        noKeepAlive.insert(host);
+    }
+    idleTimer->setSingleShot(true);
+    idleTimer->setInterval(constIdleTimeout);
+    connect(idleTimer, SIGNAL(timeout()), this, SLOT(evictIdle()));
 }
 
 Core::NetworkJob * Core::NetworkAccessManager::get(const QNetworkRequest &req, int timeout) {
     DBUG(Network) << req.url().toString();
 
     QNetworkRequest request=req;
-    request.setRawHeader("Connection", "close");
 
     // Windows builds do not support HTTPS - unless QtNetwork is recompiled...
-    NetworkJob *reply=0;
     if (QLatin1String("https")==req.url().scheme() && !QSslSocket::supportsSsl()) {
         QUrl httpUrl=request.url();
         httpUrl.setScheme(QLatin1String("http"));
         request.setUrl(httpUrl);
         DBUG(Network) << "no ssl, use" << httpUrl.toString();
-        reply = new NetworkJob(QNetworkAccessManager::get(request));
-        reply->setOrigUrl(req.url());
-    } else {
-        reply = new NetworkJob(QNetworkAccessManager::get(request));
     }
 
+    NetworkJob *reply=queue(new NetworkJob(this, req.url()), request, "GET");
     if (0!=timeout) {
         connect(reply, SIGNAL(destroyed()), SLOT(replyFinished()));
         connect(reply, SIGNAL(finished()), SLOT(replyFinished()));
@@ -199,8 +232,7 @@ Core::NetworkJob * Core::NetworkAccessManager::post(QNetworkRequest req, const Q
     for (; it!=end; ++it) {
         req.setRawHeader(it.key(), it.value());
     }
-//    req.setRawHeader("Connection", "close");
-    NetworkJob *reply=new NoRedirectNetworkJob(QNetworkAccessManager::post(req, data));
+    NetworkJob *reply=queue(new NoRedirectNetworkJob(this, req.url()), req, "POST", data);
     if (0!=timeout) {
         connect(reply, SIGNAL(destroyed()), SLOT(replyFinished()));
         connect(reply, SIGNAL(finished()), SLOT(replyFinished()));
@@ -217,9 +249,138 @@ Core::NetworkJob * Core::NetworkAccessManager::sendCustomRequest(QNetworkRequest
     for (; it!=end; ++it) {
         req.setRawHeader(it.key(), it.value());
     }
-    req.setRawHeader("Connection", "close");
 
-    return new NoRedirectNetworkJob(QNetworkAccessManager::sendCustomRequest(req, verb));
+    return queue(new NoRedirectNetworkJob(this, req.url()), req, verb);
+}
+
+/*
+ * Connections are kept alive, and re-used by QNetworkAccessManager, so limit the number of
+ * concurrent requests to each host. Requests over this limit wait until a previous one
+ * has finished - in order of the request's priority, and then in the order they were made.
+ */
+Core::NetworkJob * Core::NetworkAccessManager::queue(NetworkJob *job, QNetworkRequest req, const QByteArray &verb, const QByteArray &data) {
+    QString host=hostKey(req.url());
+    if (noKeepAlive.contains(req.url().host())) {
+        req.setRawHeader("Connection", "close");
+    }
+    connect(job, SIGNAL(finished()), SLOT(requestFinished()));
+    connect(job, SIGNAL(destroyed(QObject*)), SLOT(requestDestroyed(QObject*)));
+    QList<Request> &queued=waiting[host];
+    int pos=queued.count();
+    // QNetworkRequest::Priority values are lower for more urgent requests
+    while (pos>0 && queued.at(pos-1).req.priority()>req.priority()) {
+        --pos;
+    }
+    queued.insert(pos, Request(job, req, verb, data));
+    startRequests(host);
+    return job;
+}
+
+void Core::NetworkAccessManager::startRequests(const QString &host) {
+    QHash<QString, QList<Request> >::Iterator it=waiting.find(host);
+    if (it==waiting.end()) {
+        return;
+    }
+
+    while (inFlight.value(host)<maxPerHost && !it.value().isEmpty()) {
+        start(host, it.value().takeFirst());
+    }
+    if (it.value().isEmpty()) {
+        waiting.erase(it);
+    }
+}
+
+void Core::NetworkAccessManager::start(const QString &host, const Request &r) {
+    QNetworkReply *reply=0;
+    if ("GET"==r.verb) {
+        reply=QNetworkAccessManager::get(r.req);
+    } else if ("POST"==r.verb) {
+        reply=QNetworkAccessManager::post(r.req, r.data);
+    } else {
+        reply=QNetworkAccessManager::sendCustomRequest(r.req, r.verb);
+    }
+
+    int &count=inFlight[host];
+    numRequests++;
+    if (!noKeepAlive.contains(r.req.url().host())) {
+        // Qt does not say which connection a reply used, so estimate: if fewer requests are
+        // active than connections are open to the host, then an idle connection is re-used
+        int &conns=connections[host];
+        if (count<conns) {
+            numReused++;
+        } else {
+            conns++;
+        }
+    }
+    count++;
+    running.insert(r.job, host);
+    r.job->setJob(reply);
+    idleTimer->stop();
+}
+
+bool Core::NetworkAccessManager::takeWaiting(NetworkJob *job) {
+    QHash<QString, QList<Request> >::Iterator it=waiting.begin();
+    QHash<QString, QList<Request> >::Iterator end=waiting.end();
+    for (; it!=end; ++it) {
+        for (int i=0; i<it.value().count(); ++i) {
+            if (it.value().at(i).job==job) {
+                it.value().removeAt(i);
+                if (it.value().isEmpty()) {
+                    waiting.erase(it);
+                }
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void Core::NetworkAccessManager::release(NetworkJob *job, bool closed) {
+    QHash<NetworkJob *, QString>::Iterator it=running.find(job);
+    if (it==running.end()) {
+        return;
+    }
+    QString host=it.value();
+    running.erase(it);
+    if (--inFlight[host]<=0) {
+        inFlight.remove(host);
+    }
+    if (closed) {
+        QHash<QString, int>::Iterator conn=connections.find(host);
+        if (conn!=connections.end() && --conn.value()<=0) {
+            connections.erase(conn);
+        }
+    }
+    DBUG(Network) << host << "requests:" << numRequests << "waiting:" << waiting.value(host).count()
+                  << "reused:" << numReused << "(" << (numRequests ? (numReused*100)/numRequests : 0) << "% est.)";
+    startRequests(host);
+    if (running.isEmpty()) {
+        idleTimer->start();
+    }
+}
+
+void Core::NetworkAccessManager::requestFinished() {
+    NetworkJob *job=static_cast<NetworkJob *>(sender());
+    QNetworkReply *reply=job->actualJob();
+    // Connection is not kept after an error, or if the host asked for it to be closed
+    release(job, !reply || QNetworkReply::NoError!=reply->error() || "close"==reply->rawHeader("Connection").toLower());
+}
+
+void Core::NetworkAccessManager::requestDestroyed(QObject *obj) {
+    // Object is being destroyed, so only compare pointers
+    NetworkJob *job=static_cast<NetworkJob *>(obj);
+    if (!takeWaiting(job)) {
+        // Request was aborted, which closes its connection
+        release(job, true);
+    }
+}
+
+void Core::NetworkAccessManager::evictIdle() {
+    DBUG(Network) << "Closing idle connections";
+    connections.clear();
+    #if QT_VERSION >= 0x050900
+    clearConnectionCache();
+    #endif
 }
 
 void Core::NetworkAccessManager::replyFinished() {
@@ -233,7 +394,13 @@ void Core::NetworkAccessManager::timerEvent(QTimerEvent *e) {
     DBUG(Network) << (void *)job;
     if (job) {
         stopTimer(job);
-        job->abortJob();
+        if (takeWaiting(job)) {
+            // Still waiting for a connection - so there is no request to abort, just report the failure
+            emit job->error(QNetworkReply::OperationCanceledError);
+            emit job->finished();
+        } else {
+            job->abortJob();
+        }
     }
 }
 
@@ -27,6 +27,8 @@
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
 #include <QMap>
+#include <QHash>
+#include <QSet>
 #include <QTimer>
 
 class QTimerEvent;
@@ -38,6 +40,7 @@ class NetworkJob : public QObject {
     Q_OBJECT
 public:
     NetworkJob(QNetworkReply *j);
+    NetworkJob(QObject *parent, const QUrl &u);
     virtual ~NetworkJob();
 
     QNetworkReply * actualJob() const { return job; }
@@ -74,6 +77,7 @@ private Q_SLOTS:
     void handleReadyRead();
 
 protected:
+    void setJob(QNetworkReply *j);
     void connectJob();
     void cancelJob();
     void abortJob();
@@ -117,13 +121,41 @@ protected:
 
 private Q_SLOTS:
     void replyFinished();
+    void requestFinished();
+    void requestDestroyed(QObject *obj);
+    void evictIdle();
 
 private:
+    // Details required to start a request that is waiting for a free connection
+    struct Request {
+        Request(NetworkJob *j=0, const QNetworkRequest &r=QNetworkRequest(), const QByteArray &v=QByteArray(),
+                const QByteArray &d=QByteArray())
+            : job(j), req(r), verb(v), data(d) { }
+        NetworkJob *job;
+        QNetworkRequest req;
+        QByteArray verb;
+        QByteArray data;
+    };
+
     void stopTimer(NetworkJob *job);
+    NetworkJob * queue(NetworkJob *job, QNetworkRequest req, const QByteArray &verb, const QByteArray &data=QByteArray());
+    void startRequests(const QString &host);
+    void start(const QString &host, const Request &r);
+    bool takeWaiting(NetworkJob *job);
+    void release(NetworkJob *job, bool closed);
 
 private:
     bool enabled;
+    int maxPerHost;
+    QSet<QString> noKeepAlive; // Hosts known to misbehave with persistent connections
     QMap<NetworkJob *, int> timers;
+    QHash<QString, QList<Request> > waiting;
+    QHash<NetworkJob *, QString> running;
+    QHash<QString, int> inFlight;
+    QHash<QString, int> connections; // Estimated number of open connections to each host
+    QTimer *idleTimer;
+    quint64 numRequests;
+    quint64 numReused;
     friend class NetworkJob;
 };
 
@@ -0,0 +1,59 @@
+/*
+ * Madrigal
+ *
+ * Copyright (c) 2016 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "core/stringpool.h"
+#include "core/globalstatic.h"
+#include "core/debug.h"
+
+GLOBAL_STATIC(Core::StringPool, instance)
+
+QString Core::StringPool::intern(const QString &str) {
+    if (str.isEmpty()) {
+        return str;
+    }
+    QSet<QString>::ConstIterator it=strings.constFind(str);
+    if (strings.constEnd()==it) {
+        strings.insert(str);
+        return str;
+    }
+    if (it->constData()!=str.constData()) {
+        saved+=str.size()*sizeof(QChar);
+    }
+    return *it;
+}
+
+/*
+ * Remove strings that are no longer used by any item.
+ */
+void Core::StringPool::squeeze() {
+    int before=strings.count();
+    QSet<QString>::Iterator it=strings.begin();
+    while (strings.end()!=it) {
+        if (it->isDetached()) {
+            it=strings.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    DBUGF(Devices) << "strings:" << strings.count() << "removed:" << (before-strings.count()) << "bytes saved (cumulative):" << saved;
+}
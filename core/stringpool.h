@@ -0,0 +1,53 @@
+/*
+ * Madrigal
+ *
+ * Copyright (c) 2016 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef CORE_STRING_POOL_H
+#define CORE_STRING_POOL_H
+
+#include <QSet>
+#include <QString>
+
+namespace Core {
+
+/*
+ * Shares the data of identical strings - e.g. artist, album, and genre names - between all of
+ * the items that use them. Should only be used from the GUI thread.
+ */
+class StringPool {
+public:
+    static StringPool * self();
+
+    StringPool() : saved(0) { }
+    QString intern(const QString &str);
+    void squeeze();
+    // Total of string data not allocated, due to sharing, since start. Not reduced when items are freed.
+    quint64 cumulativeBytesSaved() const { return saved; }
+
+private:
+    QSet<QString> strings;
+    quint64 saved;
+};
+
+}
+
+#endif
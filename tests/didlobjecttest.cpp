@@ -0,0 +1,155 @@
+/*
+ * Madrigal
+ *
+ * Copyright (c) 2016 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "didlobjecttest.h"
+#include "upnp/didlobject.h"
+#include <QtTest>
+#include <QXmlStreamReader>
+
+using namespace Upnp;
+
+static const int constNumItems=100000;
+
+// The parser that Device::objectValues() used before DidlObject, kept here for comparison
+static QMap<QString, QString> objectValues(QXmlStreamReader &reader) {
+    QMap<QString, QString> values;
+    QString elem=reader.name().toString();
+    QXmlStreamAttributes attributes=reader.attributes();
+    foreach (const QXmlStreamAttribute &attr, attributes) {
+        values.insert(attr.name().toString(), attr.value().toString());
+    }
+
+    while (!reader.atEnd()) {
+        reader.readNext();
+
+        if (reader.isStartElement()) {
+            QString key=reader.name().toString();
+            if (QLatin1String("artist")==key) {
+                QXmlStreamAttributes attributes=reader.attributes();
+                if (attributes.value(QLatin1String("role"))==QLatin1String("AlbumArtist")) {
+                    key=QLatin1String("albumArtist");
+                }
+            } else if (QLatin1String("res")==key) {
+                QXmlStreamAttributes attributes=reader.attributes();
+                foreach (const QXmlStreamAttribute &attr, attributes) {
+                    values.insert("res."+attr.name().toString(), attr.value().toString());
+                }
+            }
+            values.insert(key, reader.readElementText());
+        } else if (reader.isEndElement() && elem==reader.name()) {
+            break;
+        }
+    }
+    return values;
+}
+
+static QByteArray didlItem(int i) {
+    return QString("<item id=\"64$%1\" parentID=\"64$%3\" restricted=\"1\">"
+                   "<dc:title>Track %1</dc:title>"
+                   "<dc:creator>Artist %2</dc:creator>"
+                   "<upnp:class>object.item.audioItem.musicTrack</upnp:class>"
+                   "<upnp:artist>Artist %2</upnp:artist>"
+                   "<upnp:artist role=\"AlbumArtist\">Artist %2</upnp:artist>"
+                   "<upnp:album>Album %3</upnp:album>"
+                   "<upnp:genre>Rock</upnp:genre>"
+                   "<upnp:originalTrackNumber>%4</upnp:originalTrackNumber>"
+                   "<upnp:albumArtURI>http://192.168.1.10:8200/AlbumArt/%3.jpg</upnp:albumArtURI>"
+                   "<dc:date>2016-01-01</dc:date>"
+                   "<res duration=\"0:04:01.000\" size=\"25165824\" protocolInfo=\"http-get:*:audio/flac:*\">"
+                   "http://192.168.1.10:8200/MediaItems/%1.flac</res>"
+                   "</item>").arg(i).arg(i/100).arg(i/10).arg(1+(i%10)).toUtf8();
+}
+
+void DidlObjectTest::initTestCase() {
+    corpus="<DIDL-Lite xmlns=\"urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/\" "
+           "xmlns:dc=\"http://purl.org/dc/elements/1.1/\" "
+           "xmlns:upnp=\"urn:schemas-upnp-org:metadata-1-0/upnp/\">";
+    for (int i=0; i<constNumItems; ++i) {
+        corpus+=didlItem(i);
+    }
+    corpus+="</DIDL-Lite>";
+}
+
+void DidlObjectTest::compare() {
+    QXmlStreamReader mapReader(corpus);
+    QXmlStreamReader objReader(corpus);
+    int count=0;
+
+    // The first thousand items are enough to cover every field
+    while (count<1000 && !mapReader.atEnd()) {
+        mapReader.readNext();
+        if (mapReader.isStartElement() && QLatin1String("item")==mapReader.name()) {
+            QMap<QString, QString> values=objectValues(mapReader);
+            while (!objReader.atEnd() && !(objReader.isStartElement() && QLatin1String("item")==objReader.name())) {
+                objReader.readNext();
+            }
+            DidlObject obj=DidlObject::read(objReader);
+
+            for (int f=DidlObject::Field_Unknown+1; f<DidlObject::Field_Count; ++f) {
+                QString key=DidlObject::Field_AlbumArtist==f ? QLatin1String("albumArtist") : QLatin1String(DidlObject::name((DidlObject::Field)f));
+                QCOMPARE(obj.contains((DidlObject::Field)f), values.contains(key));
+                QCOMPARE(obj.value((DidlObject::Field)f), values.value(key));
+            }
+            QMap<QString, QString>::ConstIterator it=obj.res.constBegin();
+            QMap<QString, QString>::ConstIterator end=obj.res.constEnd();
+            for (; it!=end; ++it) {
+                QCOMPARE(it.value(), values.value("res."+it.key()));
+            }
+            QCOMPARE(obj.res.count(), 3);
+            QVERIFY(obj.other.contains("restricted"));
+            count++;
+        }
+    }
+    QCOMPARE(count, 1000);
+}
+
+void DidlObjectTest::benchmark_data() {
+    QTest::addColumn<bool>("typed");
+
+    QTest::newRow("QMap") << false;
+    QTest::newRow("DidlObject") << true;
+}
+
+void DidlObjectTest::benchmark() {
+    QFETCH(bool, typed);
+
+    int count=0;
+    QBENCHMARK {
+        QXmlStreamReader reader(corpus);
+        count=0;
+        while (!reader.atEnd()) {
+            reader.readNext();
+            if (reader.isStartElement() && QLatin1String("item")==reader.name()) {
+                if (typed) {
+                    DidlObject::read(reader);
+                } else {
+                    objectValues(reader);
+                }
+                count++;
+            }
+        }
+    }
+    QCOMPARE(count, constNumItems);
+}
+
+QTEST_GUILESS_MAIN(DidlObjectTest)
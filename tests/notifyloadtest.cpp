@@ -0,0 +1,137 @@
+/*
+ * Madrigal
+ *
+ * Copyright (c) 2016 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "notifyloadtest.h"
+#include "upnp/httpserver.h"
+#include <QTcpSocket>
+#include <QHostAddress>
+#include <QtTest>
+
+static const char * constResponse="HTTP/1.1 200 OK\r\nCONTENT-LENGTH: 0\r\n\r\n";
+
+// If 'longLength' is set, then CONTENT-LENGTH is 1 byte too large - as some devices send
+static QByteArray notifyRequest(const QByteArray &sid, int seq, bool chunked, bool longLength) {
+    QByteArray body="<?xml version=\"1.0\"?><e:propertyset xmlns:e=\"urn:schemas-upnp-org:event-1-0\">"
+                    "<e:property><Volume>"+QByteArray::number(seq%100)+"</Volume></e:property>"
+                    "<e:property><TransportState>Playing</TransportState></e:property>"
+                    "</e:propertyset>";
+    QByteArray req="NOTIFY / HTTP/1.1\r\n"
+                   "HOST: 127.0.0.1\r\n"
+                   "CONTENT-TYPE: text/xml; charset=\"utf-8\"\r\n"
+                   "NT: upnp:event\r\n"
+                   "NTS: upnp:propchange\r\n"
+                   "SID: "+sid+"\r\n"
+                   "SEQ: "+QByteArray::number(seq)+"\r\n";
+    if (chunked) {
+        int half=body.length()/2;
+        req+="TRANSFER-ENCODING: chunked\r\n\r\n"+
+             QByteArray::number(half, 16)+"\r\n"+body.left(half)+"\r\n"+
+             QByteArray::number(body.length()-half, 16)+"\r\n"+body.mid(half)+"\r\n"
+             "0\r\n\r\n";
+    } else {
+        req+="CONTENT-LENGTH: "+QByteArray::number(body.length()+(longLength ? 1 : 0))+"\r\n\r\n"+body;
+    }
+    return req;
+}
+
+void NotifyLoadTest::notification(const QByteArray &sid, const Upnp::Properties &props, int seq) {
+    QHash<QByteArray, int>::Iterator it=lastSeq.find(sid);
+    if ((lastSeq.end()==it ? -1 : it.value())+1!=seq || 2!=props.count()) {
+        invalid++;
+    }
+    lastSeq[sid]=seq;
+    received++;
+}
+
+void NotifyLoadTest::initTestCase() {
+    server=new Upnp::HttpServer(this);
+    server->start();
+    QVERIFY(server->isListening());
+    connect(server, SIGNAL(notification(QByteArray,Upnp::Properties,int)), SLOT(notification(QByteArray,Upnp::Properties,int)));
+}
+
+void NotifyLoadTest::cleanupTestCase() {
+    server->close();
+}
+
+void NotifyLoadTest::load_data() {
+    QTest::addColumn<int>("connections");
+    QTest::addColumn<int>("events");
+    QTest::addColumn<bool>("chunked");
+    QTest::addColumn<bool>("longLength");
+
+    QTest::newRow("1 connection") << 1 << 2000 << false << false;
+    QTest::newRow("16 connections") << 16 << 250 << false << false;
+    QTest::newRow("64 connections") << 64 << 50 << false << false;
+    QTest::newRow("16 connections, chunked") << 16 << 250 << true << false;
+    QTest::newRow("16 connections, long CONTENT-LENGTH") << 16 << 250 << false << true;
+}
+
+/*
+ * Each connection writes all of its events at once, so that HttpServer has to handle
+ * pipelined requests - as well as many connections being active at the same time.
+ */
+void NotifyLoadTest::load() {
+    QFETCH(int, connections);
+    QFETCH(int, events);
+    QFETCH(bool, chunked);
+    QFETCH(bool, longLength);
+
+    received=0;
+    invalid=0;
+    lastSeq.clear();
+
+    QObject owner;
+    QList<QTcpSocket *> sockets;
+    QList<QByteArray> requests;
+    for (int c=0; c<connections; ++c) {
+        QTcpSocket *sock=new QTcpSocket(&owner);
+        sock->connectToHost(QHostAddress::LocalHost, server->serverPort());
+        QVERIFY(sock->waitForConnected(5000));
+        sockets.append(sock);
+
+        QByteArray sid="uuid:load-"+QByteArray::number(c);
+        QByteArray data;
+        for (int e=0; e<events; ++e) {
+            data+=notifyRequest(sid, e, chunked, longLength);
+        }
+        requests.append(data);
+    }
+
+    QBENCHMARK_ONCE {
+        for (int c=0; c<connections; ++c) {
+            sockets.at(c)->write(requests.at(c));
+        }
+        QTRY_COMPARE_WITH_TIMEOUT(received, connections*events, 30000);
+    }
+    QCOMPARE(invalid, 0);
+
+    // Every request on a keep-alive connection must be answered
+    QByteArray expected=QByteArray(constResponse).repeated(events);
+    foreach (QTcpSocket *sock, sockets) {
+        QTRY_COMPARE_WITH_TIMEOUT(sock->bytesAvailable(), (qint64)expected.length(), 10000);
+        QCOMPARE(sock->readAll(), expected);
+    }
+}
+
+QTEST_GUILESS_MAIN(NotifyLoadTest)
@@ -0,0 +1,61 @@
+/*
+ * Madrigal
+ *
+ * Copyright (c) 2016 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef NOTIFY_LOAD_TEST_H
+#define NOTIFY_LOAD_TEST_H
+
+#include "upnp/property.h"
+#include <QObject>
+#include <QHash>
+
+namespace Upnp {
+class HttpServer;
+}
+
+/*
+ * Sends many GENA NOTIFY requests, over several keep-alive connections, to HttpServer and
+ * checks that each is parsed - and reported in order - once.
+ */
+class NotifyLoadTest : public QObject {
+    Q_OBJECT
+
+public:
+    NotifyLoadTest() : server(0), received(0), invalid(0) { }
+
+public Q_SLOTS:
+    void notification(const QByteArray &sid, const Upnp::Properties &props, int seq);
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void load_data();
+    void load();
+
+private:
+    Upnp::HttpServer *server;
+    int received;
+    int invalid; // Events that were out of sequence, or not fully parsed
+    QHash<QByteArray, int> lastSeq;
+};
+
+#endif
@@ -0,0 +1,189 @@
+/*
+ * Madrigal
+ *
+ * Copyright (c) 2016 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "resultparsertest.h"
+#include "upnp/resultparser.h"
+#include <QtTest>
+
+using namespace Upnp;
+
+static const int constNumItems=2000;
+static const int constPacketSize=1400;
+
+static QString didlItem(const QString &col, int i) {
+    return QString("<item id=\"%5$%1\" parentID=\"%5\" restricted=\"1\">"
+                   "<dc:title>Track %1</dc:title>"
+                   "<upnp:class>object.item.audioItem.musicTrack</upnp:class>"
+                   "<upnp:artist>Artist %2</upnp:artist>"
+                   "<upnp:artist role=\"AlbumArtist\">Artist %2</upnp:artist>"
+                   "<upnp:album>Album %3</upnp:album>"
+                   "<upnp:genre>Rock</upnp:genre>"
+                   "<upnp:originalTrackNumber>%4</upnp:originalTrackNumber>"
+                   "<res duration=\"0:04:01.000\" protocolInfo=\"http-get:*:audio/flac:*\">http://192.168.1.10:8200/MediaItems/%1.flac</res>"
+                   "</item>").arg(i).arg(i/100).arg(i/10).arg(1+(i%10)).arg(col);
+}
+
+// Browse response, with the DIDL-Lite escaped inside <Result> as a server sends it
+static QByteArray browseResponse(const QString &col, int count) {
+    QString didl=QLatin1String("<DIDL-Lite xmlns=\"urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/\" "
+                               "xmlns:dc=\"http://purl.org/dc/elements/1.1/\" "
+                               "xmlns:upnp=\"urn:schemas-upnp-org:metadata-1-0/upnp/\">");
+    for (int i=0; i<count; ++i) {
+        didl+=didlItem(col, i);
+    }
+    didl+=QLatin1String("</DIDL-Lite>");
+
+    return QByteArray("<?xml version=\"1.0\"?>"
+                      "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+                      "s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\"><s:Body>"
+                      "<u:BrowseResponse xmlns:u=\"urn:schemas-upnp-org:service:ContentDirectory:1\"><Result>")
+            +didl.toHtmlEscaped().toUtf8()
+            +"</Result><NumberReturned>"+QByteArray::number(count)+"</NumberReturned>"
+            +"<TotalMatches>"+QByteArray::number(count*2)+"</TotalMatches>"
+            +"<UpdateID>17</UpdateID></u:BrowseResponse></s:Body></s:Envelope>";
+}
+
+void ResultParserTest::initTestCase() {
+    QByteArray response=browseResponse("64", constNumItems);
+    for (int i=0; i<response.size(); i+=constPacketSize) {
+        packets.append(response.mid(i, constPacketSize));
+    }
+}
+
+void ResultParserTest::streaming() {
+    ResultParser parser(0);
+    DidlObject obj;
+    int firstPacket=-1;
+    int count=0;
+
+    for (int p=0; p<packets.size(); ++p) {
+        parser.addData(packets.at(p));
+        while (parser.next(obj)) {
+            if (-1==firstPacket) {
+                firstPacket=p;
+                QCOMPARE(obj.value(DidlObject::Field_Id), QString("64$0"));
+                QCOMPARE(obj.value(DidlObject::Field_Title), QString("Track 0"));
+                QCOMPARE(obj.value(DidlObject::Field_AlbumArtist), QString("Artist 0"));
+                QCOMPARE(obj.res.value("duration"), QString("0:04:01.000"));
+                QVERIFY(!obj.raw.isEmpty());
+            }
+            count++;
+        }
+    }
+
+    // The first item must be available long before the rest of the response has arrived
+    QVERIFY(firstPacket>=0);
+    QVERIFY(firstPacket<packets.size()/10);
+    QVERIFY(parser.isComplete());
+    QCOMPARE(count, constNumItems);
+    QCOMPARE(parser.numObjects(), (quint32)constNumItems);
+    QCOMPARE(parser.numberReturned(), (quint32)constNumItems);
+    QCOMPARE(parser.totalMatches(), (quint32)constNumItems*2);
+    QCOMPARE(parser.updateId(), (quint32)17);
+    QCOMPARE(obj.value(DidlObject::Field_Title), QString("Track %1").arg(constNumItems-1));
+}
+
+void ResultParserTest::latency_data() {
+    QTest::addColumn<bool>("all");
+
+    QTest::newRow("first object") << false;
+    QTest::newRow("whole response") << true;
+}
+
+void ResultParserTest::latency() {
+    QFETCH(bool, all);
+
+    int count=0;
+    QBENCHMARK {
+        ResultParser parser(0);
+        DidlObject obj;
+        count=0;
+        foreach (const QByteArray &packet, packets) {
+            parser.addData(packet);
+            while (parser.next(obj)) {
+                count++;
+                if (!all) {
+                    break;
+                }
+            }
+            if (!all && count) {
+                break;
+            }
+        }
+    }
+    QCOMPARE(count, all ? constNumItems : 1);
+}
+
+// Parse what has arrived, holding objects back as MediaServer does for pages that are not yet next
+static void receive(ResultParser &parser, const QByteArray &data) {
+    DidlObject obj;
+    parser.addData(data);
+    while (parser.next(obj)) {
+        parser.pending.append(obj);
+    }
+}
+
+static ResultParser * findPage(const QList<ResultParser *> &parsers, const QByteArray &id, quint32 start) {
+    foreach (ResultParser *parser, parsers) {
+        if (parser->isPage(id, start)) {
+            return parser;
+        }
+    }
+    return 0;
+}
+
+void ResultParserTest::interleaved() {
+    static const int constPageSize=50;
+    // Two collections whose first pages arrive at the same time
+    ResultParser albums(0);
+    ResultParser artists(0);
+    ResultParser search(0);
+    albums.setPage("1$7", 0);
+    artists.setPage("1$6", 0);
+    QByteArray albumsResponse=browseResponse("1$7", constPageSize);
+    QByteArray artistsResponse=browseResponse("1$6", constPageSize);
+
+    for (int i=0; i<qMax(albumsResponse.size(), artistsResponse.size()); i+=constPacketSize) {
+        receive(albums, albumsResponse.mid(i, constPacketSize));
+        receive(artists, artistsResponse.mid(i, constPacketSize));
+    }
+    QVERIFY(albums.isComplete());
+    QVERIFY(artists.isComplete());
+
+    QList<ResultParser *> parsers=QList<ResultParser *>() << &search << &albums << &artists;
+    QCOMPARE(findPage(parsers, "1$6", 0), &artists);
+    QCOMPARE(findPage(parsers, "1$7", 0), &albums);
+    QVERIFY(!findPage(parsers, "1$7", constPageSize));
+    QVERIFY(!findPage(parsers, QByteArray(), 0));
+
+    foreach (const QByteArray &id, QList<QByteArray>() << "1$6" << "1$7") {
+        ResultParser *parser=findPage(parsers, id, 0);
+        QCOMPARE(parser->pending.count(), constPageSize);
+        for (int i=0; i<constPageSize; ++i) {
+            QCOMPARE(parser->pending.at(i).value(DidlObject::Field_ParentId), QString(id));
+            QCOMPARE(parser->pending.at(i).value(DidlObject::Field_Id), QString(id)+"$"+QString::number(i));
+        }
+    }
+}
+
+QTEST_GUILESS_MAIN(ResultParserTest)
@@ -0,0 +1,49 @@
+/*
+ * Madrigal
+ *
+ * Copyright (c) 2016 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef RESULT_PARSER_TEST_H
+#define RESULT_PARSER_TEST_H
+
+#include <QObject>
+
+/*
+ * Feeds a large Browse response into ResultParser a packet at a time, to check that objects
+ * are returned whilst the response is still arriving - and times how long the first object,
+ * and the whole response, take to parse. Also checks that the pages of collections that are
+ * browsed at the same time are kept apart.
+ */
+class ResultParserTest : public QObject {
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void streaming();
+    void latency_data();
+    void latency();
+    void interleaved();
+
+private:
+    QList<QByteArray> packets;
+};
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ * Madrigal
+ *
+ * Copyright (c) 2016 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "ssdpmessagetest.h"
+#include "upnp/ssdpmessage.h"
+#include <QtTest>
+
+using namespace Upnp;
+
+Q_DECLARE_METATYPE(Upnp::SsdpMessage::Type)
+Q_DECLARE_METATYPE(Upnp::SsdpMessage::Nts)
+
+static const char * constMSearch=
+    "M-SEARCH * HTTP/1.1\r\n"
+    "HOST: 239.255.255.250:1900\r\n"
+    "MAN: \"ssdp:discover\"\r\n"
+    "MX: 2\r\n"
+    "ST: upnp:rootdevice\r\n"
+    "\r\n";
+
+static const char * constSearchResponse=
+    "HTTP/1.1 200 OK\r\n"
+    "CACHE-CONTROL: max-age=1800\r\n"
+    "DATE: Sat, 01 Oct 2016 10:00:00 GMT\r\n"
+    "ST: upnp:rootdevice\r\n"
+    "USN: uuid:4d696e69-444c-164e-9d41-b827eb54e939::upnp:rootdevice\r\n"
+    "EXT:\r\n"
+    "SERVER: Linux/4.4 DLNADOC/1.50 UPnP/1.0 MiniDLNA/1.1.5\r\n"
+    "LOCATION: http://192.168.1.10:8200/rootDesc.xml\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n";
+
+static const char * constSearchResponseLoose=
+    "HTTP/1.1 200 OK\r\n"
+    "cache-control:  no-cache=\"Ext\", max-age = 900 \r\n"
+    "st:upnp:rootdevice\r\n"
+    "usn:\tuuid:a1b2c3d4-0000-1111-2222-333344445555::upnp:rootdevice\r\n"
+    "location:   http://[fe80::1]:49152/description.xml  \r\n"
+    "BOOTID.UPNP.ORG: 7\r\n"
+    "CONFIGID.UPNP.ORG: 1337\r\n"
+    "\r\n";
+
+static const char * constNotifyAlive=
+    "NOTIFY * HTTP/1.1\r\n"
+    "HOST: 239.255.255.250:1900\r\n"
+    "CACHE-CONTROL: max-age=120\r\n"
+    "LOCATION: http://192.168.1.20:55178/Ds/device.xml\r\n"
+    "NT: urn:av-openhome-org:service:Playlist:1\r\n"
+    "NTS: ssdp:alive\r\n"
+    "SERVER: Linux/3.x UPnP/1.0 OpenHome/1.0\r\n"
+    "USN: uuid:0a1b2c3d-4e5f-6071-8293-a4b5c6d7e8f9::urn:av-openhome-org:service:Playlist:1\r\n"
+    "BOOTID.UPNP.ORG: 42\r\n"
+    "CONFIGID.UPNP.ORG: 3\r\n"
+    "\r\n";
+
+static const char * constNotifyByeBye=
+    "NOTIFY * HTTP/1.1\r\n"
+    "HOST: 239.255.255.250:1900\r\n"
+    "NT: upnp:rootdevice\r\n"
+    "NTS: ssdp:byebye\r\n"
+    "USN: uuid:0a1b2c3d-4e5f-6071-8293-a4b5c6d7e8f9::upnp:rootdevice\r\n"
+    "\r\n";
+
+// No CACHE-CONTROL, and only \n line endings
+static const char * constNotifyBare=
+    "NOTIFY * HTTP/1.1\n"
+    "HOST: 239.255.255.250:1900\n"
+    "LOCATION: http://192.168.1.30/desc.xml\n"
+    "NT: upnp:rootdevice\n"
+    "NTS: ssdp:alive\n"
+    "USN: uuid:deadbeef-0000-0000-0000-000000000001::upnp:rootdevice\n";
+
+void SsdpMessageTest::parse_data() {
+    QTest::addColumn<QByteArray>("packet");
+    QTest::addColumn<SsdpMessage::Type>("type");
+    QTest::addColumn<SsdpMessage::Nts>("nts");
+    QTest::addColumn<int>("age");
+    QTest::addColumn<QByteArray>("usn");
+    QTest::addColumn<QByteArray>("location");
+    QTest::addColumn<QByteArray>("target");
+    QTest::addColumn<QByteArray>("bootId");
+    QTest::addColumn<QByteArray>("configId");
+
+    QTest::newRow("m-search") << QByteArray(constMSearch) << SsdpMessage::Type_Other << SsdpMessage::Nts_Other
+                              << 1800 << QByteArray() << QByteArray() << QByteArray() << QByteArray() << QByteArray();
+    QTest::newRow("search response") << QByteArray(constSearchResponse) << SsdpMessage::Type_SearchResponse << SsdpMessage::Nts_Other
+                                     << 1800 << QByteArray("uuid:4d696e69-444c-164e-9d41-b827eb54e939::upnp:rootdevice")
+                                     << QByteArray("http://192.168.1.10:8200/rootDesc.xml") << QByteArray("upnp:rootdevice")
+                                     << QByteArray() << QByteArray();
+    QTest::newRow("search response, loose") << QByteArray(constSearchResponseLoose) << SsdpMessage::Type_SearchResponse << SsdpMessage::Nts_Other
+                                            << 900 << QByteArray("uuid:a1b2c3d4-0000-1111-2222-333344445555::upnp:rootdevice")
+                                            << QByteArray("http://[fe80::1]:49152/description.xml") << QByteArray("upnp:rootdevice")
+                                            << QByteArray("7") << QByteArray("1337");
+    QTest::newRow("notify alive") << QByteArray(constNotifyAlive) << SsdpMessage::Type_Notify << SsdpMessage::Nts_Alive
+                                  << 120 << QByteArray("uuid:0a1b2c3d-4e5f-6071-8293-a4b5c6d7e8f9::urn:av-openhome-org:service:Playlist:1")
+                                  << QByteArray("http://192.168.1.20:55178/Ds/device.xml") << QByteArray("urn:av-openhome-org:service:Playlist:1")
+                                  << QByteArray("42") << QByteArray("3");
+    QTest::newRow("notify byebye") << QByteArray(constNotifyByeBye) << SsdpMessage::Type_Notify << SsdpMessage::Nts_ByeBye
+                                   << 1800 << QByteArray("uuid:0a1b2c3d-4e5f-6071-8293-a4b5c6d7e8f9::upnp:rootdevice")
+                                   << QByteArray() << QByteArray("upnp:rootdevice") << QByteArray() << QByteArray();
+    QTest::newRow("notify bare") << QByteArray(constNotifyBare) << SsdpMessage::Type_Notify << SsdpMessage::Nts_Alive
+                                 << 1800 << QByteArray("uuid:deadbeef-0000-0000-0000-000000000001::upnp:rootdevice")
+                                 << QByteArray("http://192.168.1.30/desc.xml") << QByteArray("upnp:rootdevice")
+                                 << QByteArray() << QByteArray();
+}
+
+void SsdpMessageTest::parse() {
+    QFETCH(QByteArray, packet);
+    QFETCH(SsdpMessage::Type, type);
+    QFETCH(SsdpMessage::Nts, nts);
+    QFETCH(int, age);
+    QFETCH(QByteArray, usn);
+    QFETCH(QByteArray, location);
+    QFETCH(QByteArray, target);
+    QFETCH(QByteArray, bootId);
+    QFETCH(QByteArray, configId);
+
+    SsdpMessage msg;
+    QCOMPARE(msg.parse(packet.constData(), packet.size()), SsdpMessage::Type_Other!=type);
+    QCOMPARE(msg.type, type);
+    if (SsdpMessage::Type_Other==type) {
+        return;
+    }
+    QCOMPARE(msg.nts, nts);
+    QCOMPARE(msg.age, age);
+    QCOMPARE(msg.usn, usn);
+    QCOMPARE(msg.location, location);
+    QCOMPARE(msg.target, target);
+    QCOMPARE(msg.bootId, bootId);
+    QCOMPARE(msg.configId, configId);
+}
+
+/*
+ * A busy network is mostly NOTIFY traffic, with bursts of search responses, so weight
+ * the corpus the same way.
+ */
+void SsdpMessageTest::benchmark() {
+    QList<QByteArray> corpus;
+    for (int i=0; i<100; ++i) {
+        corpus << constNotifyAlive << constNotifyAlive << constNotifyAlive << constNotifyByeBye << constNotifyBare
+               << constSearchResponse << constSearchResponseLoose << constMSearch;
+    }
+
+    int parsed=0;
+    QBENCHMARK {
+        parsed=0;
+        SsdpMessage msg;
+        foreach (const QByteArray &packet, corpus) {
+            if (msg.parse(packet.constData(), packet.size())) {
+                parsed++;
+            }
+        }
+    }
+    QCOMPARE(parsed, 700);
+}
+
+QTEST_GUILESS_MAIN(SsdpMessageTest)
@@ -24,6 +24,9 @@
 #include "upnp/device.h"
 #include "upnp/httpserver.h"
 #include "upnp/devicesmodel.h"
+#include "upnp/subscriptions.h"
+#include "upnp/didlobject.h"
+#include "upnp/itempool.h"
 #include "core/debug.h"
 #include "core/networkaccessmanager.h"
 #include "core/monoicon.h"
@@ -31,7 +34,7 @@
 #include "config.h"
 #include <QXmlStreamReader>
 #include <QXmlStreamWriter>
-#include <QTimer>
+#include <QElapsedTimer>
 
 const char * Upnp::Device::constTrackClass="object.item.audioItem.musicTrack";
 const char * Upnp::Device::constBroadcastClass="object.item.audioItem.audioBroadcast";
@@ -41,24 +44,43 @@ const char * Upnp::Device::constMsgTypeProperty="type";
 static const char * constMsgBodyProperty="body";
 static const char * constAttemptProperty="attempt";
 static const int constMaxMsgAttempts=3;
+static const int constMaxDeviceCommands=4;
+static const int constMaxCommands=8;
+static const int constCommandDeadlines[Upnp::Device::Prio_Count]={ 5000, 10000, 30000, 0 }; // ms, 0==none
+static QList<Upnp::Device *> allDevices;
+static int nextDevice=0;
+static QElapsedTimer commandClock;
 const int Upnp::Device::constNotifTimeout=2;
+static const char * constMsgUrlProperty="url";
+static const char * constMsgDeadlineProperty="deadline";
+static const char * constMsgSentProperty="sent";
+static const char * constMsgPriorityProperty="priority";
+static const char * constRenewalProperty="renewal";
+static const char * constResyncProperty="resync";
 static const int constSubTimeout=1800;
-static const int constSubRenewTimeout=1740;
 static QColor monoIconColor=Qt::black;
 QMap<Core::MonoIcon::Type, QIcon> monoIcons;
 
-Upnp::Device::MusicTrack::MusicTrack(const QMap<QString, QString> &values, Item *p, int r)
-    : Upnp::Device::Item(values["title"], p, r)
+void * Upnp::Device::Item::operator new(size_t size) {
+    return ItemPool::alloc(size);
+}
+
+void Upnp::Device::Item::operator delete(void *ptr, size_t size) {
+    ItemPool::free(ptr, size);
+}
+
+Upnp::Device::MusicTrack::MusicTrack(const DidlObject &obj, Item *p, int r)
+    : Upnp::Device::Item(obj.value(DidlObject::Field_Title), p, r)
 {
-    isBroadcast=QLatin1String(constBroadcastClass)==values["class"];
-    url=values["res"];
-    artist=values["artist"];
-    albumArtist=values["albumArtist"];
-    creator=values["creator"];
-    album=values["album"];
-    genre=values["genre"];
-    track=values["originalTrackNumber"].toUInt();
-    artUrl=values["albumArtURI"];
+    isBroadcast=QLatin1String(constBroadcastClass)==obj.value(DidlObject::Field_Class);
+    url=obj.value(DidlObject::Field_Res);
+    artist=obj.value(DidlObject::Field_Artist);
+    albumArtist=obj.value(DidlObject::Field_AlbumArtist);
+    creator=obj.value(DidlObject::Field_Creator);
+    album=obj.value(DidlObject::Field_Album);
+    genre=obj.value(DidlObject::Field_Genre);
+    track=obj.value(DidlObject::Field_OriginalTrackNumber).toUInt();
+    artUrl=obj.value(DidlObject::Field_AlbumArtUri);
 
     if (!isBroadcast && !name.isEmpty() && artist.isEmpty() && album.isEmpty() && 0==track && genre.isEmpty() && creator.isEmpty()) {
         isBroadcast=true;
@@ -66,13 +88,16 @@ Upnp::Device::MusicTrack::MusicTrack(const QMap<QString, QString> &values, Item
     if (artUrl.isEmpty()) {
         artUrl=Core::Images::self()->constDefaultImage;
     }
-    if (values["date"].contains("-")) {
-        year=values["date"].split("-").first().toUInt();
+    date=obj.value(DidlObject::Field_Date);
+    if (date.contains("-")) {
+        year=date.split("-").first().toUInt();
     }
-    date=values["date"];
     duration=0;
-    if (values.contains("res.duration")) {
-        QStringList parts=values["res.duration"].split(":");
+    res=obj.res;
+    didl=obj.raw;
+    QMap<QString, QString>::ConstIterator dur=res.constFind(QLatin1String("duration"));
+    if (res.constEnd()!=dur) {
+        QStringList parts=dur.value().split(":");
         if (!parts.isEmpty()) {
             quint16 multiple=1;
             for (int i=parts.size()-1; i>=0; --i) {
@@ -81,14 +106,6 @@ Upnp::Device::MusicTrack::MusicTrack(const QMap<QString, QString> &values, Item
             }
         }
     }
-    QMap<QString, QString>::ConstIterator it=values.constBegin();
-    QMap<QString, QString>::ConstIterator end=values.constEnd();
-    QString resKey=QLatin1String("res.");
-    for (; it!=end; ++it) {
-        if (it.key().startsWith(resKey)) {
-            res.insert(it.key().mid(4), it.value());
-        }
-    }
 }
 
 Core::ImageDetails Upnp::Device::MusicTrack::cover() const {
@@ -143,6 +160,10 @@ QString Upnp::Device::MusicTrack::describe() const {
 }
 
 QByteArray Upnp::Device::MusicTrack::toXml() const {
+    if (!didl.isEmpty()) {
+        return DidlObject::toDocument(didl);
+    }
+
     QByteArray xml;
     QXmlStreamWriter writer(&xml);
 
@@ -240,14 +261,65 @@ QIcon Upnp::Device::monoIcon(Core::MonoIcon::Type icon) {
     return icn;
 }
 
+// Parse the granted "TIMEOUT: Second-N" header
+static quint32 subscriptionTimeout(const QByteArray &hdr) {
+    if (hdr.toLower().startsWith("second-")) {
+        quint32 val=hdr.mid(7).trimmed().toUInt();
+        if (val>0) {
+            return val;
+        }
+    }
+    return constSubTimeout;
+}
+
+static Upnp::Device::Priority priority(const QByteArray &type) {
+    static QMap<QByteArray, Upnp::Device::Priority> map;
+    if (map.isEmpty()) {
+        foreach (const char *t, QList<const char *>() << "Play" << "Pause" << "Stop" << "Next" << "Previous" << "SeekSecondAbsolute"
+                                                      << "SeekIndex" << "SeekId" << "SetVolume" << "SetMute" << "SetRepeat"
+                                                      << "SetShuffle" << "SetSourceIndex") {
+            map.insert(t, Upnp::Device::Prio_Transport);
+        }
+        foreach (const char *t, QList<const char *>() << "Id" << "IdArray" << "Repeat" << "Shuffle" << "TransportState" << "Volume"
+                                                      << "VolumeLimit" << "Mute" << "SourceIndex" << "SourceXml" << "Insert"
+                                                      << "DeleteId" << "DeleteAll" << "GetSystemUpdateID" << "GetSearchCapabilities") {
+            map.insert(t, Upnp::Device::Prio_Current);
+        }
+    }
+    return map.value(type, Upnp::Device::Prio_Visible);
+}
+
+// Requests to a host are queued by NetworkAccessManager, so pass on the command's priority
+static QNetworkRequest::Priority requestPriority(int prio) {
+    switch (prio) {
+    case Upnp::Device::Prio_Transport:
+    case Upnp::Device::Prio_Current:
+        return QNetworkRequest::HighPriority;
+    case Upnp::Device::Prio_Visible:
+        return QNetworkRequest::NormalPriority;
+    default:
+        return QNetworkRequest::LowPriority;
+    }
+}
+
+static QNetworkRequest subscriptionRequest(const QUrl &url) {
+    QNetworkRequest req(url);
+    req.setPriority(QNetworkRequest::LowPriority);
+    return req;
+}
+
 Upnp::Device::Device(const Ssdp::Device &device, DevicesModel *parent)
     : QAbstractItemModel(parent)
-    , subTimer(0)
     , model(parent)
     , active(false)
     , details(device)
+    , dispatchQueued(false)
     , state(State_Initial)
 {
+    if (!commandClock.isValid()) {
+        commandClock.start();
+    }
+    allDevices.append(this);
     if (DBUG_ENABLED(Devices)) {
         Ssdp::Device::Services::ConstIterator it=details.services.constBegin();
         Ssdp::Device::Services::ConstIterator end=details.services.constEnd();
@@ -258,6 +330,7 @@ Upnp::Device::Device(const Ssdp::Device &device, DevicesModel *parent)
 }
 
 Upnp::Device::~Device() {
+    allDevices.removeAll(this);
     cancelAllJobs();
     cancelSubscriptions();
 }
@@ -319,7 +392,7 @@ QVariant Upnp::Device::data(const QModelIndex &index, int role) const {
 
 void Upnp::Device::clear() {
     beginResetModel();
-    qDeleteAll(items);
+    ItemPool::self()->release(items);
     items.clear();
     cancelAllJobs();
     endResetModel();
@@ -331,24 +404,41 @@ void Upnp::Device::reset() {
     populate();
 }
 
-void Upnp::Device::notification(const QByteArray &sid, const QByteArray &data, int seq) {
-    // If we recieve multiple notifications *very* close together, its possible for
-    // them to be read in the wrong order! So, if we a have actioned a new notification,
-    // skip any old ones
-    Subscription sub(sid);
-    QHash<QUrl, Subscription>::Iterator it=subscriptions.begin();
-    QHash<QUrl, Subscription>::Iterator end=subscriptions.end();
+/*
+ * Network connection has been re-established. Rather than clearing, and re-populating, the
+ * model (which is slow for large queues) ask the device for its current state - the
+ * differences can then be applied.
+ */
+void Upnp::Device::reconnect() {
+    if (items.isEmpty() || !reconcile()) {
+        reset();
+        return;
+    }
+    DBUG(Devices) << "Warm reconnect" << details.uuid;
+    // Renew existing subscriptions, rather than replacing them - otherwise the device keeps sending
+    // events to the old SIDs until they expire. A renewal that fails falls back to a fresh subscription.
+    Ssdp::Device::Services::ConstIterator it=details.services.constBegin();
+    Ssdp::Device::Services::ConstIterator end=details.services.constEnd();
     for(; it!=end; ++it) {
-        if (it.value()==sub) {
-            if (-1==it.value().lastSeq || it.value().lastSeq<seq) {
-                notification(sid, data);
-                it.value().lastSeq=seq;
-            }
-            return;
+        if (subscriptions.contains(it.key())) {
+            renewSubscription(it.key());
+        } else {
+            subscribe(it.key());
         }
     }
 }
 
+/*
+ * Event(s) for service have been missed, so re-query its state. By default, this is the
+ * same as a reconnect.
+ */
+void Upnp::Device::resync(const QByteArray &service) {
+    DBUG(Devices) << details.uuid << service;
+    if (!items.isEmpty() && !reconcile()) {
+        reset();
+    }
+}
+
 void Upnp::Device::setActive(bool a) {
     if (a==active) {
         return;
@@ -368,39 +458,14 @@ void Upnp::Device::setActive(bool a) {
     }
 }
 
-QMap<QString, QString> Upnp::Device::objectValues(QXmlStreamReader &reader) {
-    QMap<QString, QString> values;
-    QString elem=reader.name().toString();
-    QXmlStreamAttributes attributes=reader.attributes();
-    foreach (const QXmlStreamAttribute &attr, attributes) {
-        values.insert(attr.name().toString(), attr.value().toString());
-    }
-
-    while (!reader.atEnd()) {
-        reader.readNext();
-
-        if (reader.isStartElement()) {
-            QString key=reader.name().toString();
-            if (QLatin1String("artist")==key) {
-                QXmlStreamAttributes attributes=reader.attributes();
-                if (attributes.value(QLatin1String("role"))==QLatin1String("AlbumArtist")) {
-                    key=QLatin1String("albumArtist");
-                }
-            } else if (QLatin1String("res")==key) {
-                QXmlStreamAttributes attributes=reader.attributes();
-                foreach (const QXmlStreamAttribute &attr, attributes) {
-                    values.insert("res."+attr.name().toString(), attr.value().toString());
-                }
-            }
-            values.insert(key, reader.readElementText());
-        } else if (reader.isEndElement() && elem==reader.name()) {
-            break;
-        }
-    }
-    return values;
+static QByteArray envelope(const QByteArray &msg, const QByteArray &type, const QByteArray &service) {
+    return "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+           "s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
+           "<s:Body><u:"+type+" xmlns:u=\""+service+"\">"+msg+"</u:"+type+"></s:Body></s:Envelope>";
 }
 
-Core::NetworkJob * Upnp::Device::sendCommand(const QByteArray &msg, const QByteArray &type, const QByteArray &service, bool cancelOthers) {
+QObject * Upnp::Device::sendCommand(const QByteArray &msg, const QByteArray &type, const QByteArray &service, bool cancelOthers,
+                                    Priority prio) {
     Ssdp::Device::Services::ConstIterator srv=details.services.find(service);
 
     if (details.services.constEnd()!=srv) {
@@ -408,23 +473,25 @@ Core::NetworkJob * Upnp::Device::sendCommand(const QByteArray &msg, const QByteA
             cancelCommands(type);
         }
 
-        QByteArray data="<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
-                        "s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
-                        "<s:Body><u:"+type+" xmlns:u=\""+service+"\">"+msg+"</u:"+type+"></s:Body></s:Envelope>";
-        Core::NetworkAccessManager::RawHeaders headers;
+        if (Prio_Default==prio) {
+            prio=priority(type);
+        }
 
-        headers.insert("CONTENT-TYPE", "text/xml; charset=\"utf-8\"");
-        headers.insert("SOAPACTION", "\""+service+"#"+type+"\"");
-        Core::NetworkJob *job=Core::NetworkAccessManager::self()->post(QUrl(details.baseUrl+srv.value().controlUrl), data, headers);
-        connect(job, SIGNAL(finished()), this, SLOT(jobFinished()));
-        connect(job, SIGNAL(destroyed(QObject*)), this, SLOT(jobDestroyed()));
-        job->setProperty(constMsgTypeProperty, type);
-        job->setProperty(constMsgServiceProperty, service);
-        job->setProperty(constMsgBodyProperty, data);
-        job->setProperty(constAttemptProperty, 1);
-        jobs.append(job);
-        DBUG(Devices) << (void *)job << type << service;
-        return job;
+        // Command is sent by startCommand(), its properties are then copied to the NetworkJob
+        QObject *cmd=new QObject(this);
+        cmd->setProperty(constMsgTypeProperty, type);
+        cmd->setProperty(constMsgServiceProperty, service);
+        cmd->setProperty(constMsgBodyProperty, envelope(msg, type, service));
+        cmd->setProperty(constMsgUrlProperty, QUrl(details.baseUrl+srv.value().controlUrl));
+        cmd->setProperty(constAttemptProperty, 1);
+        cmd->setProperty(constMsgPriorityProperty, (int)prio);
+        if (constCommandDeadlines[prio]>0) {
+            cmd->setProperty(constMsgDeadlineProperty, commandClock.elapsed()+constCommandDeadlines[prio]);
+        }
+        commands[prio].append(cmd);
+        DBUG(Devices) << (void *)cmd << type << service << prio;
+        queueDispatch();
+        return cmd;
     }
     return 0;
 }
@@ -442,6 +509,177 @@ void Upnp::Device::cancelCommands(const QByteArray &type) {
         job->cancelAndDelete();
         jobs.removeAll(job);
     }
+    for (int p=0; p<Prio_Count; ++p) {
+        QList<QObject *>::Iterator it=commands[p].begin();
+        while (it!=commands[p].end()) {
+            if ((*it)->property(constMsgTypeProperty).toByteArray()==type) {
+                delete *it;
+                it=commands[p].erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    latestPending.remove(type);
+    if (!toCancel.isEmpty()) {
+        queueDispatch();
+    }
+}
+
+/*
+ * Send a command for a continuous control (e.g. volume, seek position). Only one such
+ * command, of each type, is outstanding at a time - if one is already waiting, or in
+ * flight, then this value replaces any previous pending value, and is sent once the
+ * outstanding command completes.
+ */
+void Upnp::Device::sendLatestCommand(const QByteArray &msg, const QByteArray &type, const QByteArray &service) {
+    // If a command of this type is still waiting to be sent, just replace its value
+    for (int p=0; p<Prio_Count; ++p) {
+        foreach (QObject *cmd, commands[p]) {
+            if (cmd->property(constMsgTypeProperty).toByteArray()==type && cmd->property(constMsgServiceProperty).toByteArray()==service) {
+                DBUG(Devices) << "Replace" << type << msg;
+                cmd->setProperty(constMsgBodyProperty, envelope(msg, type, service));
+                latestPending.remove(type);
+                return;
+            }
+        }
+    }
+    // Otherwise, if one is in flight, send this value once it has finished
+    if (hasCommand(type)) {
+        DBUG(Devices) << "Pending" << type << msg;
+        latestPending.insert(type, qMakePair(msg, service));
+    } else {
+        sendCommand(msg, type, service);
+    }
+}
+
+bool Upnp::Device::hasCommand(const QByteArray &type) const {
+    foreach (Core::NetworkJob *job, jobs) {
+        if (job->property(constMsgTypeProperty).toByteArray()==type) {
+            return true;
+        }
+    }
+    for (int p=0; p<Prio_Count; ++p) {
+        foreach (QObject *cmd, commands[p]) {
+            if (cmd->property(constMsgTypeProperty).toByteArray()==type) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void Upnp::Device::sendPendingLatest(const QByteArray &type) {
+    QHash<QByteArray, QPair<QByteArray, QByteArray> >::Iterator it=latestPending.find(type);
+    if (it!=latestPending.end() && !hasCommand(type)) {
+        QPair<QByteArray, QByteArray> cmd=it.value();
+        latestPending.erase(it);
+        sendCommand(cmd.first, type, cmd.second);
+    }
+}
+
+void Upnp::Device::queueDispatch() {
+    // Start commands from the event loop, so that callers of sendCommand() can set properties
+    if (!dispatchQueued) {
+        dispatchQueued=true;
+        QMetaObject::invokeMethod(this, "startCommands", Qt::QueuedConnection);
+    }
+}
+
+void Upnp::Device::startCommands() {
+    dispatchQueued=false;
+    dispatchCommands();
+}
+
+int Upnp::Device::commandsRunning() const {
+    int count=0;
+    foreach (Core::NetworkJob *job, jobs) {
+        if (job->property(constMsgTypeProperty).isValid()) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/*
+ * Start the highest priority waiting command, if this device has not reached its limit.
+ * Returns true if a command was started, or failed as its deadline has passed.
+ */
+bool Upnp::Device::startCommand() {
+    if (commandsRunning()>=constMaxDeviceCommands) {
+        return false;
+    }
+
+    for (int p=0; p<Prio_Count; ++p) {
+        if (!commands[p].isEmpty()) {
+            QObject *cmd=commands[p].takeFirst();
+            QVariant deadline=cmd->property(constMsgDeadlineProperty);
+            if (deadline.isValid() && deadline.toLongLong()<commandClock.elapsed()) {
+                QByteArray type=cmd->property(constMsgTypeProperty).toByteArray();
+                DBUG(Devices) << "Expired" << (void *)cmd << type;
+                failedCommand(cmd, type);
+                delete cmd;
+                sendPendingLatest(type);
+                return true;
+            }
+            Core::NetworkJob *job=postCommand(cmd);
+            DBUG(Devices) << (void *)job << job->property(constMsgTypeProperty).toByteArray() << p;
+            delete cmd;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Time, in ms, since a command's job was started
+qint64 Upnp::Device::commandTime(const Core::NetworkJob *job) {
+    return commandClock.elapsed()-job->property(constMsgSentProperty).toLongLong();
+}
+
+Core::NetworkJob * Upnp::Device::postCommand(const QObject *cmd) {
+    Core::NetworkAccessManager::RawHeaders headers;
+    headers.insert("CONTENT-TYPE", "text/xml; charset=\"utf-8\"");
+    headers.insert("SOAPACTION", "\""+cmd->property(constMsgServiceProperty).toByteArray()+"#"+
+                   cmd->property(constMsgTypeProperty).toByteArray()+"\"");
+    QNetworkRequest req(cmd->property(constMsgUrlProperty).toUrl());
+    req.setPriority(requestPriority(cmd->property(constMsgPriorityProperty).toInt()));
+    Core::NetworkJob *job=Core::NetworkAccessManager::self()->post(req, cmd->property(constMsgBodyProperty).toByteArray(), headers);
+    QList<QByteArray> props=cmd->dynamicPropertyNames();
+    foreach (const QByteArray &prop, props) {
+        job->setProperty(prop, cmd->property(prop));
+    }
+    job->setProperty(constMsgSentProperty, commandClock.elapsed());
+    connect(job, SIGNAL(finished()), this, SLOT(jobFinished()));
+    connect(job, SIGNAL(destroyed(QObject*)), this, SLOT(jobDestroyed()));
+    if (streamCommand(cmd->property(constMsgTypeProperty).toByteArray())) {
+        connect(job, SIGNAL(readyRead()), this, SLOT(jobReadyRead()));
+    }
+    jobs.append(job);
+    return job;
+}
+
+/*
+ * Share the global command limit between devices - each pass starts at most one
+ * command per device, and the device that goes first is rotated.
+ */
+void Upnp::Device::dispatchCommands() {
+    bool progress=true;
+    while (progress) {
+        progress=false;
+        int running=0;
+        foreach (Device *dev, allDevices) {
+            running+=dev->commandsRunning();
+        }
+        for (int i=0; i<allDevices.count() && running<constMaxCommands; ++i) {
+            nextDevice=(nextDevice+1)%allDevices.count();
+            Device *dev=allDevices.at(nextDevice);
+            int before=dev->commandsRunning();
+            if (dev->startCommand()) {
+                progress=true;
+                running+=dev->commandsRunning()-before;
+            }
+        }
+    }
 }
 
 //#define DISPLAY_XML
@@ -450,27 +688,37 @@ void Upnp::Device::jobFinished() {
 
     if (job) {
         jobs.removeAll(job);
+        queueDispatch();
         QByteArray msgType=job->property(constMsgTypeProperty).toByteArray();
-        qint64 responseSize=job->actualJob()->bytesAvailable();
-        #ifdef DISPLAY_XML
-        QByteArray data=job->readAll();
-        DBUG(Devices) << (void *)job << data;
-        QXmlStreamReader reader(data);
-        #else
-        QXmlStreamReader reader(job->actualJob());
-        #endif
-        while (!reader.atEnd()) {
-            reader.readNext();
-            if (QXmlStreamReader::StartElement==reader.tokenType() && QLatin1String("Envelope")==reader.name()) {
-                while (!reader.atEnd()) {
-                    reader.readNext();
-                    if (QXmlStreamReader::StartElement==reader.tokenType() && QLatin1String("Body")==reader.name()) {
-                        while (!reader.atEnd()) {
-                            reader.readNext();
-                            if (QXmlStreamReader::StartElement==reader.tokenType() && QLatin1String(msgType+"Response")==reader.name()) {
-                                commandResponse(reader, msgType, job);
-                                job->cancelAndDelete();
-                                return;
+        if (streamCommand(msgType)) {
+            commandData(msgType, job, job->readAll());
+            if (commandFinished(msgType, job)) {
+                job->cancelAndDelete();
+                sendPendingLatest(msgType);
+                return;
+            }
+        } else {
+            #ifdef DISPLAY_XML
+            QByteArray data=job->readAll();
+            DBUG(Devices) << (void *)job << data;
+            QXmlStreamReader reader(data);
+            #else
+            QXmlStreamReader reader(job->actualJob());
+            #endif
+            while (!reader.atEnd()) {
+                reader.readNext();
+                if (QXmlStreamReader::StartElement==reader.tokenType() && QLatin1String("Envelope")==reader.name()) {
+                    while (!reader.atEnd()) {
+                        reader.readNext();
+                        if (QXmlStreamReader::StartElement==reader.tokenType() && QLatin1String("Body")==reader.name()) {
+                            while (!reader.atEnd()) {
+                                reader.readNext();
+                                if (QXmlStreamReader::StartElement==reader.tokenType() && QLatin1String(msgType+"Response")==reader.name()) {
+                                    commandResponse(reader, msgType, job);
+                                    job->cancelAndDelete();
+                                    sendPendingLatest(msgType);
+                                    return;
+                                }
                             }
                         }
                     }
@@ -478,25 +726,26 @@ void Upnp::Device::jobFinished() {
             }
         }
 
-        if (job->property(constAttemptProperty).toUInt()<constMaxMsgAttempts) {
-            Core::NetworkAccessManager::RawHeaders headers;
-
-            headers.insert("CONTENT-TYPE", "text/xml; charset=\"utf-8\"");
-            headers.insert("SOAPACTION", "\""+job->property(constMsgServiceProperty).toByteArray()+"#"+
-                           job->property(constMsgTypeProperty).toByteArray()+"\"");
-            Core::NetworkJob *newJob=Core::NetworkAccessManager::self()->post(job->url(), job->property(constMsgBodyProperty).toByteArray(), headers);
-
+        if (latestPending.contains(msgType)) {
+            // A newer value is waiting, so there is no point re-trying this one
+            DBUG(Devices) << "Superseded" << (void *)job << msgType;
+        } else if (job->property(constAttemptProperty).toUInt()<constMaxMsgAttempts) {
+            // Re-queue, rather than post directly, so that the retry is subject to the same limits
+            QObject *cmd=new QObject(this);
             QList<QByteArray> props=job->dynamicPropertyNames();
             foreach (const QByteArray &prop, props) {
-                newJob->setProperty(prop, job->property(prop));
+                cmd->setProperty(prop, job->property(prop));
+            }
+            cmd->setProperty(constMsgSentProperty, QVariant());
+            cmd->setProperty(constAttemptProperty, job->property(constAttemptProperty).toUInt()+1);
+            int prio=qBound(0, job->property(constMsgPriorityProperty).toInt(), Prio_Count-1);
+            // Deadline limits how long a command waits to be sent, so each attempt gets its own
+            if (constCommandDeadlines[prio]>0) {
+                cmd->setProperty(constMsgDeadlineProperty, commandClock.elapsed()+constCommandDeadlines[prio]);
             }
-            newJob->setProperty(constAttemptProperty, job->property(constAttemptProperty).toUInt()+1);
-            connect(newJob, SIGNAL(finished()), this, SLOT(jobFinished()));
-            connect(newJob, SIGNAL(destroyed(QObject*)), this, SLOT(jobDestroyed()));
-            jobs.append(newJob);
-            DBUG(Devices) << "Re-trying" << newJob->property(constAttemptProperty).toUInt()
-                          << (void *)newJob << newJob->property(constMsgTypeProperty).toByteArray()
-                          << newJob->property(constMsgServiceProperty).toByteArray();
+            commands[prio].append(cmd);
+            DBUG(Devices) << "Re-trying" << cmd->property(constAttemptProperty).toUInt()
+                          << (void *)cmd << msgType << cmd->property(constMsgServiceProperty).toByteArray();
         } else {
             DBUG(Devices) << "Failed" << job->property(constAttemptProperty).toUInt()
                           << (void *)job << job->property(constMsgTypeProperty).toByteArray()
@@ -504,6 +753,14 @@ void Upnp::Device::jobFinished() {
             failedCommand(job, msgType);
         }
         job->cancelAndDelete();
+        sendPendingLatest(msgType);
+    }
+}
+
+void Upnp::Device::jobReadyRead() {
+    Core::NetworkJob *job=qobject_cast<Core::NetworkJob *>(sender());
+    if (job) {
+        commandData(job->property(constMsgTypeProperty).toByteArray(), job, job->readAll());
     }
 }
 
@@ -511,6 +768,7 @@ void Upnp::Device::jobDestroyed() {
     Core::NetworkJob *job=qobject_cast<Core::NetworkJob *>(sender());
     if (job) {
         jobs.removeAll(job);
+        queueDispatch();
     }
 }
 
@@ -518,13 +776,31 @@ void Upnp::Device::subscriptionResponse() {
     Core::NetworkJob *job=qobject_cast<Core::NetworkJob *>(sender());
     if (job) {
         QByteArray sid=job->actualJob()->rawHeader("SID");
-        DBUG(Devices) << sid;
-        if (!sid.isEmpty() && active) {
-            // Store this subscription, if it is new or its ID has changed.
-            // This way we can keep track of sequence IDs accross subscription renewals.
-            QHash<QUrl, Subscription>::iterator sub=subscriptions.find(job->origUrl());
-            if (sub==subscriptions.end() || sub.value().sid!=sid) {
-                subscriptions.insert(job->origUrl(), Subscription(sid));
+        QByteArray service=job->property(constMsgServiceProperty).toByteArray();
+        DBUG(Devices) << sid << service << job->ok();
+        if (active) {
+            if (!sid.isEmpty() && job->ok()) {
+                // Store this subscription, if it is new or its ID has changed.
+                QHash<QByteArray, QByteArray>::iterator sub=subscriptions.find(service);
+                if (sub==subscriptions.end() || sub.value()!=sid) {
+                    if (sub!=subscriptions.end()) {
+                        Subscriptions::self()->remove(sub.value());
+                    }
+                    subscriptions.insert(service, sid);
+                }
+                Subscriptions::self()->add(sid, this, service, subscriptionTimeout(job->actualJob()->rawHeader("TIMEOUT")));
+                if (job->property(constResyncProperty).toBool()) {
+                    resync(service);
+                }
+            } else if (job->property(constRenewalProperty).toBool() || job->property(constAttemptProperty).isValid()) {
+                // Renewal failed (e.g. 412 Precondition Failed, as the device has forgotten
+                // the SID) - so subscribe afresh, and then re-read this service's state. If
+                // that also fails, Subscriptions re-tries after an increasing delay.
+                QByteArray old=subscriptions.take(service);
+                if (!old.isEmpty()) {
+                    Subscriptions::self()->remove(old);
+                }
+                Subscriptions::self()->resubscribe(this, service, job->property(constAttemptProperty).toInt());
             }
         }
         jobs.removeAll(job);
@@ -547,6 +823,11 @@ void Upnp::Device::cancelAllJobs() {
         job->cancelAndDelete();
     }
     jobs.clear();
+    for (int p=0; p<Prio_Count; ++p) {
+        qDeleteAll(commands[p]);
+        commands[p].clear();
+    }
+    latestPending.clear();
 }
 
 void Upnp::Device::setState(State s) {
@@ -570,58 +851,82 @@ void Upnp::Device::requestSubscriptions() {
     Ssdp::Device::Services::ConstIterator it=details.services.constBegin();
     Ssdp::Device::Services::ConstIterator end=details.services.constEnd();
     for(; it!=end; ++it) {
-        QUrl url(details.baseUrl+it.value().eventUrl);
-        Core::NetworkAccessManager::RawHeaders headers;
-        //        headers["HOST"]="????";
-        headers["CALLBACK"]="<http://"+model->httpServer()->getAddress(url)+":"+QByteArray::number(model->httpServer()->serverPort())+"/>";
-        headers["NT"]="upnp:event";
-        headers["TIMEOUT"]="Second-"+QByteArray::number(constSubTimeout);
-        Core::NetworkJob *job=Core::NetworkAccessManager::self()->sendCustomRequest(url, "SUBSCRIBE", headers);
-        connect(job, SIGNAL(finished()), this, SLOT(subscriptionResponse()));
-        connect(job, SIGNAL(destroyed(QObject*)), this, SLOT(jobDestroyed()));
-        jobs.append(job);
-    }
-    if (!subTimer) {
-        subTimer=new QTimer(this);
-        connect(subTimer, SIGNAL(timeout()), this, SLOT(renewSubscriptions()));
-        subTimer->setSingleShot(true);
+        subscribe(it.key());
     }
-    if (!subTimer->isActive()) {
-        subTimer->start(constSubRenewTimeout*1000);
+}
+
+void Upnp::Device::subscribe(const QByteArray &service, bool resyncAfter, int attempt) {
+    Ssdp::Device::Services::ConstIterator it=details.services.constFind(service);
+    if (it==details.services.constEnd()) {
+        return;
     }
+    QUrl url(details.baseUrl+it.value().eventUrl);
+    Core::NetworkAccessManager::RawHeaders headers;
+    //        headers["HOST"]="????";
+    headers["CALLBACK"]="<http://"+model->httpServer()->getAddress(url, details.localAddress)+":"+QByteArray::number(model->httpServer()->serverPort())+"/>";
+    headers["NT"]="upnp:event";
+    headers["TIMEOUT"]="Second-"+QByteArray::number(constSubTimeout);
+    Core::NetworkJob *job=Core::NetworkAccessManager::self()->sendCustomRequest(subscriptionRequest(url), "SUBSCRIBE", headers);
+    job->setProperty(constMsgServiceProperty, service);
+    if (resyncAfter) {
+        job->setProperty(constResyncProperty, true);
+    }
+    if (attempt>0) {
+        job->setProperty(constAttemptProperty, attempt);
+    }
+    connect(job, SIGNAL(finished()), this, SLOT(subscriptionResponse()));
+    connect(job, SIGNAL(destroyed(QObject*)), this, SLOT(jobDestroyed()));
+    jobs.append(job);
 }
 
 void Upnp::Device::renewSubscriptions() {
+    QHash<QByteArray, QByteArray>::ConstIterator it=subscriptions.constBegin();
+    QHash<QByteArray, QByteArray>::ConstIterator end=subscriptions.constEnd();
+    for(; it!=end; ++it) {
+        renewSubscription(it.key());
+    }
+}
+
+void Upnp::Device::renewSubscription(const QByteArray &service) {
+    QHash<QByteArray, QByteArray>::ConstIterator sub=subscriptions.constFind(service);
+    Ssdp::Device::Services::ConstIterator it=details.services.constFind(service);
+    if (!active || sub==subscriptions.constEnd() || it==details.services.constEnd()) {
+        return;
+    }
+    QUrl url(details.baseUrl+it.value().eventUrl);
+    Core::NetworkAccessManager::RawHeaders headers;
+    //        headers["HOST"]="????";
+    headers["SID"]=sub.value();
+    headers["TIMEOUT"]="Second-"+QByteArray::number(constSubTimeout);
+    Core::NetworkJob *job=Core::NetworkAccessManager::self()->sendCustomRequest(subscriptionRequest(url), "SUBSCRIBE", headers);
+    job->setProperty(constMsgServiceProperty, service);
+    job->setProperty(constRenewalProperty, true);
+    connect(job, SIGNAL(finished()), this, SLOT(subscriptionResponse()));
+    connect(job, SIGNAL(destroyed(QObject*)), this, SLOT(jobDestroyed()));
+    jobs.append(job);
+}
+
+void Upnp::Device::resubscribe(const QByteArray &service, int attempt) {
     if (active) {
-        QHash<QUrl, Subscription>::ConstIterator it=subscriptions.constBegin();
-        QHash<QUrl, Subscription>::ConstIterator end=subscriptions.constEnd();
-        for(; it!=end; ++it) {
-            QUrl url(it.key());
-            Core::NetworkAccessManager::RawHeaders headers;
-            //        headers["HOST"]="????";
-            headers["SID"]=it.value().sid;
-            headers["TIMEOUT"]="Second-"+QByteArray::number(constSubTimeout);
-            Core::NetworkJob *job=Core::NetworkAccessManager::self()->sendCustomRequest(url, "SUBSCRIBE", headers);
-            connect(job, SIGNAL(finished()), this, SLOT(otherResponse()));
-            connect(job, SIGNAL(destroyed(QObject*)), this, SLOT(jobDestroyed()));
-            jobs.append(job);
-        }
-        subTimer->start(constSubRenewTimeout*1000);
+        subscribe(service, true, attempt);
     }
 }
 
 void Upnp::Device::cancelSubscriptions() {
-    if (subTimer) {
-        subTimer->stop();
-    }
-    QHash<QUrl, Subscription>::ConstIterator it=subscriptions.constBegin();
-    QHash<QUrl, Subscription>::ConstIterator end=subscriptions.constEnd();
+    Subscriptions::self()->cancelResubscribes(this);
+    QHash<QByteArray, QByteArray>::ConstIterator it=subscriptions.constBegin();
+    QHash<QByteArray, QByteArray>::ConstIterator end=subscriptions.constEnd();
     for(; it!=end; ++it) {
-        QUrl url(it.key());
+        Subscriptions::self()->remove(it.value());
+        Ssdp::Device::Services::ConstIterator service=details.services.constFind(it.key());
+        if (service==details.services.constEnd()) {
+            continue;
+        }
+        QUrl url(details.baseUrl+service.value().eventUrl);
         Core::NetworkAccessManager::RawHeaders headers;
         //        headers["HOST"]="????";
-        headers["SID"]=it.value().sid;
-        Core::NetworkJob *job=Core::NetworkAccessManager::self()->sendCustomRequest(url, "UNSUBSCRIBE", headers);
+        headers["SID"]=it.value();
+        Core::NetworkJob *job=Core::NetworkAccessManager::self()->sendCustomRequest(subscriptionRequest(url), "UNSUBSCRIBE", headers);
         connect(job, SIGNAL(finished()), this, SLOT(otherResponse()));
         connect(job, SIGNAL(destroyed(QObject*)), this, SLOT(jobDestroyed()));
         jobs.append(job);
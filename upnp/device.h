@@ -25,6 +25,7 @@
 #define UPNP_DEVICE_H
 
 #include "upnp/ssdp.h"
+#include "upnp/property.h"
 #include "core/monoicon.h"
 #include "core/utils.h"
 #include "core/images.h"
@@ -43,6 +44,7 @@ class NetworkJob;
 
 namespace Upnp {
 class DevicesModel;
+struct DidlObject;
 
 class Device : public QAbstractItemModel {
     Q_OBJECT
@@ -61,15 +63,31 @@ public:
         State_Populated
     };
 
+    // Commands are sent in priority order
+    enum Priority {
+        Prio_Transport,  // Transport, and volume, controls
+        Prio_Current,    // State of the current track, or queue
+        Prio_Visible,    // Metadata that is (probably) visible
+        Prio_Background, // Everything else
+
+        Prio_Count,
+        Prio_Default = Prio_Count // Determine from command type
+    };
+
     struct Item {
         enum Type {
             Type_MusicTrack = 0,
         };
 
+        static void * operator new(size_t size);
+        static void operator delete(void *ptr, size_t size);
+
         Item(const QString &n=QString(), Item *p=0, int r=0)
             : name(n), parent(p), row(r) { }
         virtual ~Item() { }
         virtual bool isCollection() const { return false; }
+        // Move any children to 'list', so that they may be deleted without recursion
+        virtual void takeChildren(QList<Item *> &list) { Q_UNUSED(list) }
         virtual int type() const = 0;
         virtual QString mainText() const { return name; }
         virtual QString subText() const { return QString(); }
@@ -83,7 +101,7 @@ public:
     };
 
     struct MusicTrack : public Item {
-        MusicTrack(const QMap<QString, QString> &values, Item *p=0, int r=0);
+        MusicTrack(const DidlObject &obj, Item *p=0, int r=0);
         MusicTrack(const QString &n=QString(), Item *p=0, int r=0)
             : Item(n, p, r), isBroadcast(false), track(0), year(0), duration(0) { }
         virtual ~MusicTrack() { }
@@ -110,6 +128,7 @@ public:
         QString artUrl;
         QString date;
         QMap<QString, QString> res;
+        QByteArray didl; // <item> as sent by the device - if set, this is used by toXml()
     };
 
 public:
@@ -135,15 +154,17 @@ public:
     const QString & name() const { return details.name; }
     const QString & host() const { return details.host; }
     bool isActive() const { return active; }
-    bool hasSubscription(const QByteArray &sid) const { return -1!=subscriptions.values().indexOf(Subscription(sid)); }
     bool isEmpty() const { return items.isEmpty(); }
     int numItems() const { return items.count(); }
 
     virtual void clear();
     virtual void populate() = 0;
     virtual void reset();
-    void notification(const QByteArray &sid, const QByteArray &data, int seq);
-    virtual void notification(const QByteArray &sid, const QByteArray &data) = 0;
+    void reconnect();
+    virtual void resync(const QByteArray &service);
+    void renewSubscription(const QByteArray &service);
+    void resubscribe(const QByteArray &service, int attempt);
+    virtual void notification(const QByteArray &sid, const Properties &props) = 0;
 
 Q_SIGNALS:
     void stateChanged(const QString &str);
@@ -152,45 +173,57 @@ Q_SIGNALS:
 public Q_SLOTS:
     virtual void setActive(bool a);
 
-protected:
-    static QMap<QString, QString> objectValues(QXmlStreamReader &reader);
-
 private Q_SLOTS:
     void jobFinished();
+    void jobReadyRead();
     void jobDestroyed();
     void subscriptionResponse();
     void otherResponse();
-    void renewSubscriptions();
+    void startCommands();
 
 private:
     virtual void commandResponse(QXmlStreamReader &reader, const QByteArray &type, Core::NetworkJob *job) = 0;
-    virtual void failedCommand(Core::NetworkJob *, const QByteArray &) { }
+    // Responses to streamed commands are passed to commandData() as they arrive, and then
+    // commandFinished() is called. If this returns false, the command is re-tried, or failed.
+    virtual bool streamCommand(const QByteArray &) const { return false; }
+    virtual void commandData(const QByteArray &, Core::NetworkJob *, const QByteArray &) { }
+    virtual bool commandFinished(const QByteArray &, Core::NetworkJob *) { return false; }
+    // Passed the NetworkJob - or, if its deadline passed before it could be sent, the queued command
+    virtual void failedCommand(const QObject *, const QByteArray &) { }
+    // Check for changes that occurred whilst disconnected. Return false if the device must be reset.
+    virtual bool reconcile() { return false; }
+    void queueDispatch();
+    bool startCommand();
+    int commandsRunning() const;
+    Core::NetworkJob * postCommand(const QObject *cmd);
+    static void dispatchCommands();
+    void sendPendingLatest(const QByteArray &type);
 
 protected:
     Item * toItem(const QModelIndex &index) const { return index.isValid() ? static_cast<Item*>(index.internalPointer()) : 0; }
-    Core::NetworkJob * sendCommand(const QByteArray &msg, const QByteArray &type, const QByteArray &service,
-                                   bool cancelOthers=false);
+    QObject * sendCommand(const QByteArray &msg, const QByteArray &type, const QByteArray &service,
+                          bool cancelOthers=false, Priority prio=Prio_Default);
+    void sendLatestCommand(const QByteArray &msg, const QByteArray &type, const QByteArray &service);
+    bool hasCommand(const QByteArray &type) const;
+    static qint64 commandTime(const Core::NetworkJob *job);
     void cancelCommands(const QByteArray &type);
     void cancelAllJobs();
     void setState(State s);
     void requestSubscriptions();
+    void subscribe(const QByteArray &service, bool resyncAfter=false, int attempt=0);
+    void renewSubscriptions();
     void cancelSubscriptions();
 
 protected:
-    struct Subscription {
-        Subscription(const QByteArray &id) : sid(id), lastSeq(-1) { }
-        bool operator==(const Subscription &o) const { return sid==o.sid; }
-        QByteArray sid;
-        int lastSeq;
-    };
-
-    QTimer *subTimer;
     DevicesModel *model;
     bool active;
     Ssdp::Device details;
     QList<Item *> items;
     QList<Core::NetworkJob *> jobs;
-    QHash<QUrl, Subscription> subscriptions;
+    QList<QObject *> commands[Prio_Count]; // Commands waiting to be sent
+    bool dispatchQueued;
+    QHash<QByteArray, QPair<QByteArray, QByteArray> > latestPending; // Type to message, and service
+    QHash<QByteArray, QByteArray> subscriptions; // Service type to SID
     State state;
 
     friend class DevicesModel;
@@ -30,22 +30,24 @@
 #include <QTimer>
 #include <QCoreApplication>
 
-static const int constTimeout=100;
-static const char *constTimeoutProp="times";
+static const int constTimeout=5000; // Time to wait for last active device, before using default
 
 Upnp::DevicesModel::DevicesModel(const QString &cfgName, HttpServer *h, QObject *parent)
     : QAbstractItemModel(parent)
     , http(h)
     , configName(cfgName)
     , timer(0)
+    , activationTime(-1)
 {
+    startTime.start();
     lastUuid=Core::Configuration(configName).get("lastUuid", QByteArray());
     if (!lastUuid.isEmpty()) {
+        // Last device is activated as soon as it is added, this timer is just a fallback
+        // in case it is no longer available.
         timer=new QTimer(this);
         connect(timer, SIGNAL(timeout()), SLOT(activateLast()));
-        timer->setSingleShot(false);
+        timer->setSingleShot(true);
         timer->start(constTimeout);
-        timer->setProperty(constTimeoutProp, 0);
     }
 }
 
@@ -126,6 +128,10 @@ void Upnp::DevicesModel::added(const Ssdp::Device &device) {
     for (int i=0; i<devices.count() ; ++i) {
         Device *dev=devices.at(i);
         if (dev->uuid()==device.uuid) {
+            // Device has been seen on a different interface
+            if (!device.localAddress.isEmpty()) {
+                dev->details.localAddress=device.localAddress;
+            }
             return;
         }
     }
@@ -137,6 +143,10 @@ void Upnp::DevicesModel::added(const Ssdp::Device &device) {
         beginInsertRows(QModelIndex(), devices.size(), devices.size());
         devices.append(dev);
         endInsertRows();
+        if (timer && timer->isActive() && lastUuid==dev->uuid()) {
+            timer->stop();
+            activate(dev);
+        }
     }
 }
 
@@ -192,52 +202,37 @@ void Upnp::DevicesModel::setActive(int row) {
     }
 }
 
-void Upnp::DevicesModel::notification(const QByteArray &sid, const QByteArray &data, int seq) {
-    foreach (Device *dev, devices) {
-        if (dev->isActive() && dev->hasSubscription(sid)) {
-            dev->notification(sid, data, seq);
-            return;
-        }
-    }
-}
-
 void Upnp::DevicesModel::connectionStateChanged(bool on) {
     if (on) {
         foreach (Device *dev, devices) {
             if (dev->isActive()) {
-                dev->reset();
+                dev->reconnect();
             }
         }
     }
 }
 
 void Upnp::DevicesModel::activateLast() {
-    int activeRow=-1;
+    int activeRow=defaultActiveRow();
 
-    if (lastUuid.isEmpty()) {
-        activeRow=defaultActiveRow();
-    } else {
-        for (int row=0; row<devices.count() && -1==activeRow; ++row) {
-            if (lastUuid==devices.at(row)->uuid()) {
-                activeRow=row;
-            }
+    for (int row=0; row<devices.count(); ++row) {
+        if (lastUuid==devices.at(row)->uuid()) {
+            activeRow=row;
+            break;
         }
     }
 
-    if (-1==activeRow) {
-        if (timer->property(constTimeoutProp).toInt()<50) {
-            timer->setProperty(constTimeoutProp, timer->property(constTimeoutProp).toInt()+1);
-        } else {
-            timer->stop();
-            activeRow=defaultActiveRow();
-        }
+    if (activeRow>=0 && activeRow<devices.count()) {
+        activate(devices.at(activeRow));
     }
-    if (-1!=activeRow) {
-        timer->stop();
-        if (devices.count()>activeRow) {
-            setActiveDevice(devices.at(activeRow));
-        }
+}
+
+void Upnp::DevicesModel::activate(Device *dev) {
+    if (-1==activationTime) {
+        activationTime=startTime.elapsed();
+        DBUG(Devices) << configName << dev->uuid() << "activated after" << activationTime << "ms";
     }
+    setActiveDevice(dev);
 }
 
 void Upnp::DevicesModel::clear() {
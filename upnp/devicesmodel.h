@@ -27,6 +27,7 @@
 #include "upnp/ssdp.h"
 #include <QAbstractItemModel>
 #include <QTimer>
+#include <QElapsedTimer>
 
 namespace Upnp {
 
@@ -47,6 +48,8 @@ public:
     QVariant data(const QModelIndex &, int) const;
     Qt::ItemFlags flags(const QModelIndex &index) const;
     bool isInitialising() const { return timer && timer->isActive(); }
+    // Milliseconds from startup until the initial device was activated, or -1 if not yet activated
+    qint64 startupActivationTime() const { return activationTime; }
 
     HttpServer *httpServer() { return http; }
 
@@ -57,7 +60,6 @@ public Q_SLOTS:
     virtual void added(const Ssdp::Device &device);
     void removed(const QByteArray &uuid);
     void setActive(int row);
-    void notification(const QByteArray &sid, const QByteArray &data, int seq);
     void connectionStateChanged(bool on);
 
 private Q_SLOTS:
@@ -68,6 +70,7 @@ private:
     virtual Device * createDevice(const Ssdp::Device &device)=0;
     virtual int defaultActiveRow() const { return 0; }
     void setActiveDevice(Device *dev);
+    void activate(Device *dev);
     Device * toDevice(const QModelIndex &index) const { return index.isValid() ? static_cast<Device*>(index.internalPointer()) : 0; }
 
 protected:
@@ -76,6 +79,8 @@ protected:
     QList<Device *> devices;
     QByteArray lastUuid;
     QTimer *timer;
+    QElapsedTimer startTime;
+    qint64 activationTime;
 };
 
 }
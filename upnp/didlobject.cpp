@@ -0,0 +1,205 @@
+/*
+ * Madrigal
+ *
+ * Copyright (c) 2016 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "upnp/didlobject.h"
+#include "core/stringpool.h"
+#include <QXmlStreamReader>
+
+static const char * constNames[Upnp::DidlObject::Field_Count]={
+    "",
+    "id",
+    "parentID",
+    "class",
+    "title",
+    "creator",
+    "artist",
+    "",
+    "album",
+    "genre",
+    "originalTrackNumber",
+    "albumArtURI",
+    "date",
+    "res"
+};
+
+static const int constMaxRawSize=8192;
+
+// Namespaces declared by toDocument()
+static const char * constNamespaces[][2]={
+    { "", "urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/" },
+    { "dc", "http://purl.org/dc/elements/1.1/" },
+    { "upnp", "urn:schemas-upnp-org:metadata-1-0/upnp/" },
+    { "dlna", "urn:schemas-dlna-org:metadata-1-0/" }
+};
+static const int constNumNamespaces=sizeof(constNamespaces)/sizeof(constNamespaces[0]);
+
+static bool isStandard(const QStringRef &prefix, const QStringRef &uri) {
+    for (int i=0; i<constNumNamespaces; ++i) {
+        if (QLatin1String(constNamespaces[i][0])==prefix) {
+            return QLatin1String(constNamespaces[i][1])==uri;
+        }
+    }
+    return false;
+}
+
+// Fields whose values are likely to be repeated across many objects
+static const quint32 constPooledFields=(1<<Upnp::DidlObject::Field_Class)|(1<<Upnp::DidlObject::Field_Creator)|
+                                       (1<<Upnp::DidlObject::Field_Artist)|(1<<Upnp::DidlObject::Field_AlbumArtist)|
+                                       (1<<Upnp::DidlObject::Field_Album)|(1<<Upnp::DidlObject::Field_Genre)|
+                                       (1<<Upnp::DidlObject::Field_AlbumArtUri)|(1<<Upnp::DidlObject::Field_Date);
+
+Upnp::DidlObject::Field Upnp::DidlObject::toField(const QStringRef &name) {
+    for (int i=Field_Unknown+1; i<Field_Count; ++i) {
+        if (QLatin1String(constNames[i])==name) {
+            return (Field)i;
+        }
+    }
+    return Field_Unknown;
+}
+
+const char * Upnp::DidlObject::name(Field f) {
+    return f>Field_Unknown && f<Field_Count ? constNames[f] : "";
+}
+
+/*
+ * Read a container, or item. Reader should be positioned at the start element of the object.
+ * If 'source' is the text that the reader is parsing, then the original XML of an item is
+ * also stored.
+ */
+Upnp::DidlObject Upnp::DidlObject::read(QXmlStreamReader &reader, const QString &source) {
+    DidlObject obj;
+    QString elem=reader.name().toString();
+    // Attributes cannot contain '<', so the last one before the current position starts this element
+    int start=source.isEmpty() || QLatin1String("item")!=elem
+                ? -1 : source.lastIndexOf(QLatin1Char('<'), reader.characterOffset()-1);
+    bool keepRaw=start>=0 && hasStandardNames(reader);
+    foreach (const QXmlStreamAttribute &attr, reader.attributes()) {
+        obj.insert(attr.name(), attr.value().toString());
+    }
+
+    while (!reader.atEnd()) {
+        reader.readNext();
+
+        if (reader.isStartElement()) {
+            keepRaw=keepRaw && hasStandardNames(reader);
+            Field field=toField(reader.name());
+            if (Field_Artist==field) {
+                if (reader.attributes().value(QLatin1String("role"))==QLatin1String("AlbumArtist")) {
+                    field=Field_AlbumArtist;
+                }
+            } else if (Field_Res==field) {
+                foreach (const QXmlStreamAttribute &attr, reader.attributes()) {
+                    obj.insertRes(attr.name(), attr.value().toString());
+                }
+            }
+            if (Field_Unknown==field) {
+                QString key=reader.name().toString();
+                obj.other.insert(key, reader.readElementText());
+            } else {
+                obj.insert(field, reader.readElementText());
+            }
+        } else if (reader.isEndElement() && elem==reader.name()) {
+            if (keepRaw) {
+                obj.setRaw(source, start, reader.characterOffset());
+            }
+            break;
+        }
+    }
+    return obj;
+}
+
+/*
+ * Check that the current element, and its attributes, only use the namespaces that
+ * toDocument() declares - i.e. that the element can be copied as-is.
+ */
+bool Upnp::DidlObject::hasStandardNames(const QXmlStreamReader &reader) {
+    if (!reader.namespaceDeclarations().isEmpty() || !isStandard(reader.prefix(), reader.namespaceUri())) {
+        return false;
+    }
+    foreach (const QXmlStreamAttribute &attr, reader.attributes()) {
+        if (!attr.prefix().isEmpty() && !isStandard(attr.prefix(), attr.namespaceUri())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Wrap an <item> element in a DIDL-Lite document
+ */
+QByteArray Upnp::DidlObject::toDocument(const QByteArray &item) {
+    QByteArray doc("<?xml version=\"1.0\" encoding=\"UTF-8\"?><DIDL-Lite");
+    for (int i=0; i<constNumNamespaces; ++i) {
+        doc+=" xmlns";
+        if (0!=constNamespaces[i][0][0]) {
+            doc+=':';
+            doc+=constNamespaces[i][0];
+        }
+        doc+="=\"";
+        doc+=constNamespaces[i][1];
+        doc+='"';
+    }
+    return doc+'>'+item+"</DIDL-Lite>";
+}
+
+void Upnp::DidlObject::clear() {
+    for (int i=0; i<Field_Count; ++i) {
+        values[i].clear();
+    }
+    fields=0;
+    res.clear();
+    other.clear();
+    raw.clear();
+}
+
+void Upnp::DidlObject::insert(const QStringRef &name, const QString &val) {
+    Field field=toField(name);
+    if (Field_Unknown==field) {
+        other.insert(name.toString(), val);
+    } else {
+        insert(field, val);
+    }
+}
+
+void Upnp::DidlObject::insert(Field f, const QString &val) {
+    values[f]=constPooledFields&(1<<f) ? Core::StringPool::self()->intern(val) : val;
+    fields|=(1<<f);
+}
+
+void Upnp::DidlObject::insertRes(const QStringRef &name, const QString &val) {
+    // Attribute names, and protocolInfo, are the same for most tracks
+    Core::StringPool *pool=Core::StringPool::self();
+    res.insert(pool->intern(name.toString()),
+               QLatin1String("protocolInfo")==name ? pool->intern(val) : val);
+}
+
+/*
+ * Store the original XML of an item - as long as 'start' to 'end' is a complete element, and
+ * is not too large.
+ */
+void Upnp::DidlObject::setRaw(const QString &source, int start, int end) {
+    if (start>=0 && end>start && end<=source.length() && end-start<=constMaxRawSize &&
+        QLatin1Char('<')==source.at(start) && QLatin1Char('>')==source.at(end-1)) {
+        raw=source.mid(start, end-start).toUtf8();
+    }
+}
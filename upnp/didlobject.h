@@ -0,0 +1,85 @@
+/*
+ * Madrigal
+ *
+ * Copyright (c) 2016 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef UPNP_DIDL_OBJECT_H
+#define UPNP_DIDL_OBJECT_H
+
+#include <QMap>
+#include <QString>
+#include <QByteArray>
+
+class QXmlStreamReader;
+
+namespace Upnp {
+
+// A DIDL-Lite container, or item. Fields that we use are stored by id, anything else is
+// kept in 'other'
+struct DidlObject {
+    enum Field {
+        Field_Unknown,
+
+        // Attributes
+        Field_Id,
+        Field_ParentId,
+
+        // Elements
+        Field_Class,
+        Field_Title,
+        Field_Creator,
+        Field_Artist,
+        Field_AlbumArtist, // <upnp:artist role="AlbumArtist">
+        Field_Album,
+        Field_Genre,
+        Field_OriginalTrackNumber,
+        Field_AlbumArtUri,
+        Field_Date,
+        Field_Res,
+
+        Field_Count
+    };
+
+    static Field toField(const QStringRef &name);
+    static const char * name(Field f);
+    static DidlObject read(QXmlStreamReader &reader, const QString &source=QString());
+    static bool hasStandardNames(const QXmlStreamReader &reader);
+    static QByteArray toDocument(const QByteArray &item);
+
+    DidlObject() : fields(0) { }
+    void clear();
+    bool contains(Field f) const { return fields&(1<<f); }
+    const QString & value(Field f) const { return values[f]; }
+    void insert(Field f, const QString &val);
+    void insert(const QStringRef &name, const QString &val);
+    void insertRes(const QStringRef &name, const QString &val);
+    void setRaw(const QString &source, int start, int end);
+
+    QString values[Field_Count];
+    quint32 fields;
+    QMap<QString, QString> res; // Attributes of <res>
+    QMap<QString, QString> other;
+    QByteArray raw; // Original <item> element, if this only used standard namespaces
+};
+
+}
+
+#endif
@@ -23,22 +23,47 @@
 
 #include "upnp/httpconnection.h"
 #include "core/debug.h"
-#include <QTimer>
+#include <string.h>
 
 static const int constMaxLen=32768;
+static const int constMaxLineLen=8192;
+static const int constRequestTimeout=2000;
+static const int constKeepAliveTimeout=60000;
+
+static bool equals(const char *str, int len, const char *other) {
+    int otherLen=qstrlen(other);
+    return len==otherLen && 0==qstrnicmp(str, other, len);
+}
+
+static QByteArray trimmed(const char *str, int len) {
+    while (len>0 && (' '==*str || '\t'==*str)) {
+        str++;
+        len--;
+    }
+    while (len>0 && (' '==str[len-1] || '\t'==str[len-1])) {
+        len--;
+    }
+    return QByteArray(str, len);
+}
 
 Upnp::HttpConnection::HttpConnection(qintptr socketDescriptor, QObject *p)
     : QTcpSocket(p)
-    , headersReceived(false)
+    , state(State_RequestLine)
+    , pos(0)
+    , remaining(0)
+    , contentLength(0)
     , chunked(false)
-    , allChunksReceived(false)
-    , size(0)
+    , keepAlive(true)
+    , lastHeader(0)
 {
+    // Buffers are sized for the largest line, and body, that we accept - so that
+    // parsing does not need to re-allocate.
+    buffer.reserve(constMaxLineLen);
+    body.reserve(constMaxLen);
     setSocketDescriptor(socketDescriptor);
-    timer=new QTimer(this);
-    connect(timer, SIGNAL(timeout()), SLOT(timeout()));
     connect(this, SIGNAL(readyRead()), SLOT(readData()));
-    timer->start(2000);
+    connect(this, SIGNAL(disconnected()), SLOT(deleteLater()));
+    activity.start();
 }
 
 Upnp::HttpConnection::~HttpConnection() {
@@ -50,94 +75,238 @@ void Upnp::HttpConnection::close() {
     QTcpSocket::close();
 }
 
-void Upnp::HttpConnection::timeout() {
-    DBUG(Http);
-    close();
+/*
+ * A connection is allowed a short time to complete a request, but may be kept open
+ * for longer between requests - so that devices can re-use this for their next event.
+ */
+bool Upnp::HttpConnection::hasTimedOut() const {
+    bool idle=State_RequestLine==state && pos==buffer.size();
+    return activity.elapsed()>(idle ? constKeepAliveTimeout : constRequestTimeout);
 }
 
 void Upnp::HttpConnection::readData() {
-    while (bytesAvailable()) {
-        if (headersReceived) {
-            if (chunked) {
-                QByteArray data = readLine().replace("\n\r", "").trimmed();
-                if (!data.isEmpty()) {
-                    bool ok=false;
-                    qint64 len=data.toInt(&ok, 16);
-                    if (!ok || len<0 || len>constMaxLen) {
-                        DBUG(Http) << "Invalid chunk len" << len << ok;
-                        close();
-                        return;
-                    }
-                    if (0==len) {
-                        allChunksReceived=true;
+    activity.restart();
+    while (bytesAvailable()>0) {
+        if (pos>0) {
+            // Move unparsed data to start of buffer
+            buffer.remove(0, pos);
+            pos=0;
+        }
+        int room=constMaxLineLen-buffer.size();
+        if (room<=0) {
+            DBUG(Http) << "Line too long";
+            close();
+            return;
+        }
+        int start=buffer.size();
+        buffer.resize(start+room);
+        qint64 len=read(buffer.data()+start, room);
+        if (len<0) {
+            close();
+            return;
+        }
+        buffer.resize(start+len);
+        if (!parse()) {
+            close();
+            return;
+        }
+    }
+}
+
+bool Upnp::HttpConnection::parse() {
+    for (;;) {
+        const char *data=buffer.constData()+pos;
+        int len=buffer.size()-pos;
+
+        switch (state) {
+        case State_Body:
+        case State_ChunkData:
+            if (State_Body==state && 1==remaining && body.endsWith('>') &&
+                (0==len || (keepAlive && ' '!=data[0] && '\t'!=data[0] && '\r'!=data[0] && '\n'!=data[0]))) {
+                // Some devices send a CONTENT-LENGTH 1 byte too large... If more data has been received on
+                // a persistent connection, and it is not trailing whitespace, then it is the next request.
+                messageComplete();
+                if (0==len) {
+                    return true;
+                }
+            } else if (0==len) {
+                return true;
+            } else {
+                int amount=qMin(len, remaining);
+                body.append(data, amount);
+                pos+=amount;
+                remaining-=amount;
+                if (0==remaining) {
+                    if (State_Body==state) {
+                        messageComplete();
                     } else {
-                        QByteArray newData=read(len);
-                        if (newData.length()!=len) {
-                            DBUG(Http) << "Failed to read chunk";
-                            close();
-                            return;
-                        }
-                        body+=newData;
+                        state=State_ChunkEnd;
                     }
                 }
-            } else {
-                body+=readAll();
             }
-            if ( (chunked && allChunksReceived) || (!chunked && (body.size()>=size || (body.size()==size-1 && body.at(body.size()-1)=='>')))) {
-                DBUG(Http) << "finished" << body.size() << size;
-                emit notification(headers["SID"], body.replace("\r", ""), headers["SEQ"].toUInt());
-                QByteArray resp="HTTP/1.1 200 OK\r\nCONNECTION: close\r\nCONTENT-LENGTH: 41\r\nCONTENT-TYPE: text/html\r\n\r\n"
-                                "<html><body><h1>200 OK</h1></body></html>";
-                write(resp);
-                close();
+            break;
+        default: {
+            const char *eol=(const char *)memchr(data, '\n', len);
+            if (!eol) {
+                return true;
             }
-        } else {
-            QByteArray data = readLine().trimmed();
-            if (headers.isEmpty() && !data.startsWith("NOTIFY / HTTP/1.1")) {
-                DBUG(Http) << "Message is not a notification";
-                close();
-                return;
+            int lineLen=eol-data;
+            pos+=lineLen+1;
+            if (lineLen>0 && '\r'==data[lineLen-1]) {
+                lineLen--;
             }
-            int colon = data.indexOf(':');
-            if (colon > 0) {
-                currentHeader = data.left(colon).toUpper();
-                headers.insert(currentHeader, data.mid(colon+1).trimmed());
-                continue;
+            if (!handleLine(data, lineLen)) {
+                return false;
             }
+            break;
+        }
+        }
 
-            if (colon <= 0 && !data.isEmpty()) {
-                headers.insert(currentHeader, headers.value(currentHeader)+" "+data);
-                continue;
+        if (pos==buffer.size()) {
+            buffer.resize(0);
+            pos=0;
+            if (State_Body!=state) {
+                return true;
             }
+        }
+    }
+}
 
-            if (data.isEmpty()) {
-                QByteArray contentType = headers.value("CONTENT-TYPE");
+bool Upnp::HttpConnection::handleLine(const char *line, int len) {
+    switch (state) {
+    case State_RequestLine:
+        if (0==len) {
+            // Allow empty lines between pipelined requests
+            return true;
+        }
+        if (len<17 || 0!=qstrncmp(line, "NOTIFY / HTTP/1.", 16)) {
+            DBUG(Http) << "Message is not a notification";
+            return false;
+        }
+        resetMessage();
+        keepAlive='1'==line[16];
+        state=State_Headers;
+        return true;
+    case State_Headers: {
+        if (0==len) {
+            return headersComplete();
+        }
+        if (' '==line[0] || '\t'==line[0]) {
+            if (lastHeader) {
+                *lastHeader+=' '+trimmed(line, len);
+            }
+            return true;
+        }
+        const char *colon=(const char *)memchr(line, ':', len);
+        if (!colon) {
+            return true;
+        }
+        int keyLen=colon-line;
+        QByteArray value=trimmed(colon+1, len-(keyLen+1));
+        lastHeader=0;
+        if (equals(line, keyLen, "SID")) {
+            sid=value;
+            lastHeader=&sid;
+        } else if (equals(line, keyLen, "SEQ")) {
+            seq=value;
+        } else if (equals(line, keyLen, "CONTENT-TYPE")) {
+            contentType=value;
+            lastHeader=&contentType;
+        } else if (equals(line, keyLen, "CONTENT-LENGTH")) {
+            contentLength=value.toInt();
+        } else if (equals(line, keyLen, "TRANSFER-ENCODING")) {
+            chunked=equals(value.constData(), value.length(), "chunked");
+        } else if (equals(line, keyLen, "CONNECTION")) {
+            if (equals(value.constData(), value.length(), "close")) {
+                keepAlive=false;
+            } else if (equals(value.constData(), value.length(), "keep-alive")) {
+                keepAlive=true;
+            }
+        }
+        return true;
+    }
+    case State_ChunkSize: {
+        int end=0;
+        while (end<len && ';'!=line[end]) {
+            end++;
+        }
+        bool ok=false;
+        int chunkLen=trimmed(line, end).toInt(&ok, 16);
+        if (!ok || chunkLen<0 || chunkLen>constMaxLen-body.size()) {
+            DBUG(Http) << "Invalid chunk len" << chunkLen << ok;
+            return false;
+        }
+        if (0==chunkLen) {
+            state=State_Trailers;
+        } else {
+            remaining=chunkLen;
+            state=State_ChunkData;
+        }
+        return true;
+    }
+    case State_ChunkEnd:
+        if (0!=len) {
+            DBUG(Http) << "Failed to read chunk";
+            return false;
+        }
+        state=State_ChunkSize;
+        return true;
+    case State_Trailers:
+        if (0==len) {
+            messageComplete();
+        }
+        return true;
+    default:
+        return false;
+    }
+}
 
-                if (-1==contentType.indexOf("text/xml")) {
-                    DBUG(Http) << "Wrong content type" << contentType;
-                    close();
-                    return;
-                }
+bool Upnp::HttpConnection::headersComplete() {
+    if (-1==contentType.indexOf("text/xml")) {
+        DBUG(Http) << "Wrong content type" << contentType;
+        return false;
+    }
 
-                if ("CHUNKED"==headers.value("TRANSFER-ENCODING").toUpper()) {
-                    chunked=true;
-                } else {
-                    size = headers.value("CONTENT-LENGTH").toInt();
-                    if (size <= 0 || size> constMaxLen) {
-                        DBUG(Http) << "Invalid size" << size;
-                        close();
-                        return;
-                    }
-                }
+    if (sid.isEmpty()) {
+        DBUG(Http) << "No SID";
+        return false;
+    }
 
-                if (!headers.contains("SID")) {
-                    DBUG(Http) << "No SID";
-                    close();
-                    return;
-                }
-                DBUG(Http) << "Have headers";
-                headersReceived=true;
-            }
+    if (chunked) {
+        state=State_ChunkSize;
+    } else {
+        if (contentLength<=0 || contentLength>constMaxLen) {
+            DBUG(Http) << "Invalid size" << contentLength;
+            return false;
         }
+        remaining=contentLength;
+        state=State_Body;
     }
+    return true;
+}
+
+void Upnp::HttpConnection::messageComplete() {
+    DBUG(Http) << "finished" << body.size() << contentLength << keepAlive;
+    // Parse here, so that XML is not handled on the GUI thread
+    emit notification(sid, Property::parse(body), seq.toUInt());
+    if (keepAlive) {
+        write("HTTP/1.1 200 OK\r\nCONTENT-LENGTH: 0\r\n\r\n");
+        state=State_RequestLine;
+    } else {
+        write("HTTP/1.1 200 OK\r\nCONNECTION: close\r\nCONTENT-LENGTH: 0\r\n\r\n");
+        disconnectFromHost();
+        state=State_RequestLine;
+    }
+    resetMessage();
+}
+
+void Upnp::HttpConnection::resetMessage() {
+    body.resize(0);
+    remaining=0;
+    sid.clear();
+    seq.clear();
+    contentType.clear();
+    contentLength=0;
+    chunked=false;
+    lastHeader=0;
 }
@@ -24,9 +24,9 @@
 #ifndef HTTP_CONNECTION_H
 #define HTTP_CONNECTION_H
 
+#include "upnp/property.h"
 #include <QTcpSocket>
-
-class QTimer;
+#include <QElapsedTimer>
 
 namespace Upnp {
 
@@ -36,23 +36,45 @@ public:
     HttpConnection(qintptr socketDescriptor, QObject *p);
     virtual ~HttpConnection();
     void close();
+    bool hasTimedOut() const;
 
 Q_SIGNALS:
-    void notification(const QByteArray &sid, const QByteArray &data, int seq);
+    void notification(const QByteArray &sid, const Upnp::Properties &props, int seq);
 
 private Q_SLOTS:
-    void timeout();
     void readData();
 
 private:
-    bool headersReceived;
-    bool chunked;
-    bool allChunksReceived;
-    quint32 size;
-    QByteArray currentHeader;
+    enum State {
+        State_RequestLine,
+        State_Headers,
+        State_Body,
+        State_ChunkSize,
+        State_ChunkData,
+        State_ChunkEnd,
+        State_Trailers
+    };
+
+    bool parse();
+    bool handleLine(const char *line, int len);
+    bool headersComplete();
+    void messageComplete();
+    void resetMessage();
+
+private:
+    State state;
+    QByteArray buffer; // Data read from socket, but not yet parsed
+    int pos; // Parse position within buffer
     QByteArray body;
-    QMap<QByteArray, QByteArray> headers;
-    QTimer *timer;
+    int remaining; // Bytes remaining in body, or current chunk
+    QByteArray sid;
+    QByteArray seq;
+    QByteArray contentType;
+    int contentLength;
+    bool chunked;
+    bool keepAlive;
+    QByteArray *lastHeader; // For folded header lines
+    QElapsedTimer activity;
 };
 
 }
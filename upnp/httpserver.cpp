@@ -27,9 +27,13 @@
 #include "core/networkaccessmanager.h"
 #include "core/configuration.h"
 #include <QUdpSocket>
+#include <QTimer>
+
+static const int constCheckInterval=1000;
 
 Upnp::HttpServer::HttpServer(QObject *p)
     : QTcpServer(p)
+    , timer(0)
 {
 }
 
@@ -37,6 +41,8 @@ Upnp::HttpServer::~HttpServer() {
 }
 
 void Upnp::HttpServer::start() {
+    qRegisterMetaType<Properties>("Upnp::Properties");
+
     // Try to use previous port...
     quint16 port=Core::Configuration(metaObject()->className()).get("port", 0, 0, 65535);
     if (0!=port && !listen(QHostAddress::Any, port)) {
@@ -53,10 +59,49 @@ void Upnp::HttpServer::start() {
 
 void Upnp::HttpServer::incomingConnection(qintptr handle) {
     HttpConnection *conn=new HttpConnection(handle, this);
-    connect(conn, SIGNAL(notification(QByteArray,QByteArray,int)), SIGNAL(notification(QByteArray,QByteArray,int)));
+    connect(conn, SIGNAL(notification(QByteArray,Upnp::Properties,int)), SIGNAL(notification(QByteArray,Upnp::Properties,int)));
+    connect(conn, SIGNAL(destroyed(QObject*)), SLOT(connectionDestroyed(QObject*)));
+    connections.insert(conn);
+    if (!timer) {
+        timer=new QTimer(this);
+        connect(timer, SIGNAL(timeout()), SLOT(checkConnections()));
+    }
+    if (!timer->isActive()) {
+        timer->start(constCheckInterval);
+    }
 }
 
-QByteArray Upnp::HttpServer::getAddress(const QUrl &dest) {
+/*
+ * Connections are kept open between requests, so periodically close any that
+ * have been idle for too long - or that have not completed a request in time.
+ */
+void Upnp::HttpServer::checkConnections() {
+    foreach (HttpConnection *conn, connections) {
+        if (conn->hasTimedOut()) {
+            DBUG(Http) << "Timed out" << (void *)conn;
+            connections.remove(conn);
+            conn->close();
+        }
+    }
+    if (connections.isEmpty()) {
+        timer->stop();
+    }
+}
+
+void Upnp::HttpServer::connectionDestroyed(QObject *obj) {
+    connections.remove(static_cast<HttpConnection *>(obj));
+}
+
+/*
+ * Returns address, suitable for use in a URL, of this server as seen from dest. If the
+ * local address is known (from the interface the device was discovered on) then this
+ * is used, otherwise the route to dest is checked.
+ */
+QByteArray Upnp::HttpServer::getAddress(const QUrl &dest, const QByteArray &local) {
+    if (!local.isEmpty()) {
+        return local.contains(':') ? ('['+local+']') : local;
+    }
+
     QString host=dest.host();
     QMap<QString, QByteArray>::ConstIterator it=addresses.find(host);
     if (it!=addresses.constEnd()) {
@@ -65,8 +110,13 @@ QByteArray Upnp::HttpServer::getAddress(const QUrl &dest) {
 
     QUdpSocket testSocket(0);
     testSocket.connectToHost(host, 1, QIODevice::ReadOnly);
-    QByteArray address=testSocket.localAddress().toString().toLatin1();
+    QHostAddress localAddress=testSocket.localAddress();
     testSocket.close();
+    localAddress.setScopeId(QString());
+    QByteArray address=localAddress.toString().toLatin1();
+    if (QAbstractSocket::IPv6Protocol==localAddress.protocol()) {
+        address='['+address+']';
+    }
     addresses.insert(host, address);
     return address;
 }
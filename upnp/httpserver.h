@@ -24,30 +24,42 @@
 #ifndef UPNP_HTTP_SERVER_H
 #define UPNP_HTTP_SERVER_H
 
+#include "upnp/property.h"
 #include <QTcpServer>
 #include <QMap>
+#include <QSet>
+
+class QTimer;
 
 namespace Upnp {
 
+class HttpConnection;
+
 class HttpServer : public QTcpServer {
     Q_OBJECT
 
 public:
     HttpServer(QObject *p);
     virtual ~HttpServer();
-    QByteArray getAddress(const QUrl &dest);
+    QByteArray getAddress(const QUrl &dest, const QByteArray &local=QByteArray());
 
 Q_SIGNALS:
-    void notification(const QByteArray &sid, const QByteArray &data, int seq);
+    void notification(const QByteArray &sid, const Upnp::Properties &props, int seq);
 
 public Q_SLOTS:
     void start();
 
+private Q_SLOTS:
+    void checkConnections();
+    void connectionDestroyed(QObject *obj);
+
 private:
     void incomingConnection(qintptr handle);
 
 private:
     QMap<QString, QByteArray> addresses;
+    QSet<HttpConnection *> connections;
+    QTimer *timer;
 };
 
 }
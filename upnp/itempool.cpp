@@ -0,0 +1,114 @@
+/*
+ * Madrigal
+ *
+ * Copyright (c) 2016 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "upnp/itempool.h"
+#include "core/stringpool.h"
+#include "core/globalstatic.h"
+#include "core/debug.h"
+#include <QTimer>
+#include <new>
+
+GLOBAL_STATIC(Upnp::ItemPool, instance)
+
+static const size_t constBlockAlign=16;
+static const size_t constMaxBlockSize=256; // Larger nodes use the normal heap
+static const size_t constSlabSize=64*1024;
+static const int constReapBatch=2000; // Max number of nodes to delete per event loop iteration
+
+struct FreeBlock {
+    FreeBlock *next;
+};
+
+static FreeBlock *freeBlocks[constMaxBlockSize/constBlockAlign];
+static char *slab=0;
+static size_t slabUsed=constSlabSize;
+static int numSlabs=0;
+
+void * Upnp::ItemPool::alloc(size_t size) {
+    if (size>constMaxBlockSize) {
+        return ::operator new(size);
+    }
+    int bucket=(size+constBlockAlign-1)/constBlockAlign-1;
+    if (freeBlocks[bucket]) {
+        FreeBlock *block=freeBlocks[bucket];
+        freeBlocks[bucket]=block->next;
+        return block;
+    }
+    size_t blockSize=(bucket+1)*constBlockAlign;
+    if (slabUsed+blockSize>constSlabSize) {
+        // Slabs are never returned to the heap - freed blocks are re-used for new nodes instead
+        slab=static_cast<char *>(::operator new(constSlabSize));
+        slabUsed=0;
+        numSlabs++;
+    }
+    void *ptr=slab+slabUsed;
+    slabUsed+=blockSize;
+    return ptr;
+}
+
+void Upnp::ItemPool::free(void *ptr, size_t size) {
+    if (!ptr) {
+        return;
+    }
+    if (size>constMaxBlockSize) {
+        ::operator delete(ptr);
+        return;
+    }
+    int bucket=(size+constBlockAlign-1)/constBlockAlign-1;
+    FreeBlock *block=static_cast<FreeBlock *>(ptr);
+    block->next=freeBlocks[bucket];
+    freeBlocks[bucket]=block;
+}
+
+Upnp::ItemPool::ItemPool()
+    : reapQueued(false)
+{
+}
+
+void Upnp::ItemPool::release(const QList<Device::Item *> &items) {
+    if (items.isEmpty()) {
+        return;
+    }
+    toDelete+=items;
+    if (!reapQueued) {
+        reapQueued=true;
+        QTimer::singleShot(0, this, SLOT(reap()));
+    }
+}
+
+void Upnp::ItemPool::reap() {
+    // Children are moved into the list before their parent is deleted, so destructors do not recurse
+    for (int i=0; i<constReapBatch && !toDelete.isEmpty(); ++i) {
+        Device::Item *item=toDelete.takeLast();
+        item->takeChildren(toDelete);
+        delete item;
+    }
+
+    if (toDelete.isEmpty()) {
+        reapQueued=false;
+        DBUG(Devices) << "slabs:" << numSlabs;
+        Core::StringPool::self()->squeeze();
+    } else {
+        QTimer::singleShot(0, this, SLOT(reap()));
+    }
+}
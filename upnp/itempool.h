@@ -0,0 +1,67 @@
+/*
+ * Madrigal
+ *
+ * Copyright (c) 2016 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef UPNP_ITEM_POOL_H
+#define UPNP_ITEM_POOL_H
+
+#include "upnp/device.h"
+#include <QObject>
+#include <QList>
+
+namespace Upnp {
+
+/*
+ * Allocator for Device::Item nodes. Small nodes are carved from large slabs, with freed blocks
+ * kept (per size) for re-use - so building a large tree does not require one heap allocation
+ * per node.
+ *
+ * Trees that are no longer required are passed to release(). These are detached from the model
+ * immediately, and then deleted in batches from the event loop so that the GUI is not blocked.
+ *
+ * Should only be used from the GUI thread.
+ */
+class ItemPool : public QObject {
+    Q_OBJECT
+
+public:
+    static ItemPool * self();
+    static void * alloc(size_t size);
+    static void free(void *ptr, size_t size);
+
+    ItemPool();
+    virtual ~ItemPool() { }
+
+    void release(const QList<Device::Item *> &items);
+    void release(Device::Item *item) { release(QList<Device::Item *>() << item); }
+
+private Q_SLOTS:
+    void reap();
+
+private:
+    QList<Device::Item *> toDelete;
+    bool reapQueued;
+};
+
+}
+
+#endif
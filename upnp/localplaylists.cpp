@@ -22,6 +22,8 @@
  */
 
 #include "upnp/localplaylists.h"
+#include "upnp/didlobject.h"
+#include "upnp/itempool.h"
 #include "core/debug.h"
 #include "core/utils.h"
 #include "core/globalstatic.h"
@@ -70,12 +72,13 @@ void Upnp::LocalPlaylists::populate(const QModelIndex &index, int start) {
                 while (!reader.atEnd()) {
                     reader.readNext();
                     if (reader.isStartElement() && QLatin1String("Track")==reader.name()) {
-                        QXmlStreamReader trackReader(reader.readElementText());
+                        QString trackXml=reader.readElementText();
+                        QXmlStreamReader trackReader(trackXml);
                         while (!trackReader.atEnd()) {
                             trackReader.readNext();
                             if (trackReader.isStartElement() && QLatin1String("item")==trackReader.name()) {
                                 beginInsertRows(index, pl->children.count(), pl->children.count());
-                                pl->children.append(new Track(QByteArray(), objectValues(trackReader), pl, pl->children.count()));
+                                pl->children.append(new Track(QByteArray(), DidlObject::read(trackReader, trackXml), pl, pl->children.count()));
                                 endInsertRows();
                                 break;
                             }
@@ -152,7 +155,7 @@ void Upnp::LocalPlaylists::remove(const QModelIndexList &indexes) {
             if (QFile::remove(dir+index.data().toString()+constExt)) {
                 beginRemoveRows(QModelIndex(), pl->row, pl->row);
                 items.removeAll(pl);
-                delete pl;
+                ItemPool::self()->release(pl);
                 for (int i=pl->row; i<items.count(); ++i) {
                     items.at(i)->row=i;
                 }
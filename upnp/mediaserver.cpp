@@ -22,6 +22,9 @@
  */
 
 #include "upnp/mediaserver.h"
+#include "upnp/resultparser.h"
+#include "upnp/didlobject.h"
+#include "upnp/itempool.h"
 #include "core/networkaccessmanager.h"
 #include "core/debug.h"
 #include "core/roles.h"
@@ -32,11 +35,18 @@
 
 const char * Upnp::MediaServer::constContentDirService="urn:schemas-upnp-org:service:ContentDirectory:1";
 static const int constBrowseChunkSize=500;
+static const int constMinBrowseChunkSize=100;
+static const int constMaxBrowseChunkSize=2000;
+static const int constFastBrowse=500; // If a page takes less than this (ms), then page size is increased
+static const int constSlowBrowse=2000; // ...and more than this, decreased
+static const int constMaxBrowsePages=3; // Max concurrent Browse requests per server
 static const int constSearchChunkSize=100;
 static const int constMaxSearchResults=2000;
 static const int constSearchTimeout=10000;
 static const int constCommandTimeout=15000;
 static const char * constIdProperty="id";
+static const char * constStartProperty="start";
+static const char * constCountProperty="count";
 static const QByteArray constRootId("0");
 
 static const QByteArray & itemId(Upnp::Device::Item * item) {
@@ -45,8 +55,8 @@ static const QByteArray & itemId(Upnp::Device::Item * item) {
                 : constRootId;
 }
 
-Upnp::MediaServer::Track::Track(const QByteArray &i, const QMap<QString, QString> &values, Item *p, int r)
-    : Upnp::Device::MusicTrack(values, p, r)
+Upnp::MediaServer::Track::Track(const QByteArray &i, const DidlObject &obj, Item *p, int r)
+    : Upnp::Device::MusicTrack(obj, p, r)
     , id(i)
 {
     // Attempt to determine album-artist
@@ -77,6 +87,7 @@ Upnp::MediaServer::MediaServer(const Ssdp::Device &device, DevicesModel *parent)
     , updateId(0)
     , lastColUpdateId(0)
     , numChildrenSkipped(0)
+    , browseChunkSize(constBrowseChunkSize)
 {
     manufacturer=QLatin1String("minimserver.com")==device.manufacturer ? Man_Minim : Man_Other;
 }
@@ -86,6 +97,8 @@ Upnp::MediaServer::~MediaServer() {
 
 void Upnp::MediaServer::clear() {
     cancelCommands();
+    itemIndex.clear();
+    browsing.clear();
     Device::clear();
     updateId=lastColUpdateId=0;
     numChildrenSkipped=0;
@@ -296,7 +309,8 @@ void Upnp::MediaServer::refresh(const QModelIndex &index, bool force) {
 
     if (!col->children.isEmpty()) {
         beginRemoveRows(index, 0, col->children.count()-1);
-        qDeleteAll(col->children);
+        removeFromIndex(col->children);
+        ItemPool::self()->release(col->children);
         col->children.clear();
         endRemoveRows();
     }
@@ -327,59 +341,25 @@ void Upnp::MediaServer::play(const QModelIndexList &indexes, qint32 pos, PlayCom
     checkCommand();
 }
 
-Upnp::Device::Item * findItem(QList<Upnp::Device::Item *> &list, QList<QByteArray> ids) {
-    if (ids.isEmpty()) {
-        return 0;
-    }
-
-    QByteArray toFind=ids.takeFirst();
-    foreach (Upnp::Device::Item *item, list) {
-//        if (Upnp::Device::Item::Type_MusicTrack==item->type() && static_cast<Upnp::MediaServer::Track *>(item)->id==toFind) {
-//            return item;
-//        }
-        if (item->isCollection() && static_cast<Upnp::MediaServer::Collection *>(item)->id==toFind) {
-            return ids.isEmpty() ? item : findItem(static_cast<Upnp::MediaServer::Collection *>(item)->children, ids);
-        }
-    }
-    return 0;
-}
-
 void Upnp::MediaServer::play(const QList<QByteArray> &ids, qint32 row) {
     DBUG(MediaServers) << ids << row;
-    QList<QByteArray> parentHeirarchy;
-    QList<Item *> *lastParentList=&items;
     QModelIndexList indexes;
 
     foreach (const QByteArray &i, ids) {
         QList<QByteArray> h=toHierarchyList(i);
         if (!h.isEmpty()) {
             QByteArray id=h.takeLast();
-            QList<Item *> *list=&items;
+            Item *parentItem=0;
             if (!h.isEmpty()) {
-                if (h==parentHeirarchy) {
-                    list=lastParentList;
-                } else {
-                    Item *p=::findItem(items, h);
-                    if (!p || !p->isCollection()) {
-                        DBUG(MediaServers) << "ERROR: Failed to find parent" << h;
-                        return;
-                    }
-                    list=lastParentList=&(static_cast<Upnp::MediaServer::Collection *>(p)->children);
-                }
-            }
-            Item *found=0;
-            foreach (Item *item, *list) {
-                if (item->isCollection() && static_cast<Upnp::MediaServer::Collection *>(item)->id==id) {
-                    DBUG(MediaServers) << "C" << item->name << static_cast<Upnp::MediaServer::Collection *>(item)->id;
-                    found=item;
-                    break;
-                } else if (!item->isCollection() && static_cast<Upnp::MediaServer::Track *>(item)->id==id) {
-                    DBUG(MediaServers) << "T" << item->name << static_cast<Upnp::MediaServer::Collection *>(item)->id;
-                    found=item;
-                    break;
+                parentItem=itemIndex.value(h.last());
+                if (!parentItem || !parentItem->isCollection()) {
+                    DBUG(MediaServers) << "ERROR: Failed to find parent" << h;
+                    return;
                 }
             }
-            if (found) {
+            Item *found=itemIndex.value(id);
+            if (found && found->parent==parentItem) {
+                DBUG(MediaServers) << (found->isCollection() ? "C" : "T") << found->name << id;
                 indexes.append(createIndex(found->row, 0, found));
             } else {
                 DBUG(MediaServers) << "ERROR: Failed to find" << id;
@@ -455,6 +435,15 @@ void Upnp::MediaServer::populate() {
     }
 }
 
+bool Upnp::MediaServer::reconcile() {
+    if (State_Populating==state) {
+        return false;
+    }
+    // Model is only refreshed if SystemUpdateID has changed
+    sendCommand(QByteArray(), "GetSystemUpdateID", constContentDirService);
+    return true;
+}
+
 void Upnp::MediaServer::populate(const QModelIndex &index, int start) {
     DBUG(Devices) << index.row();
     Item *item=toItem(index);
@@ -468,81 +457,249 @@ void Upnp::MediaServer::populate(const QModelIndex &index, int start) {
         emit dataChanged(index, index);
     }
 
+    BrowsePages &pages=browsing[id];
+    pages=BrowsePages();
+    pages.next=start;
+    pages.requested=start+browseChunkSize;
+    pages.running.insert(start);
+    browse(id, start, browseChunkSize);
+}
+
+void Upnp::MediaServer::browse(const QByteArray &id, quint32 start, quint32 count, Priority prio) {
+    DBUG(MediaServers) << id << start << count << prio;
     // TODO: Specify sort
-    sendCommand("<ObjectID>"+id+"</ObjectID><BrowseFlag>BrowseDirectChildren</BrowseFlag><Filter>*</Filter>"
-                "<SortCriteria></SortCriteria><StartingIndex>"+QByteArray::number(start)+
-                "</StartingIndex><RequestedCount>"+QByteArray::number(constBrowseChunkSize)+"</RequestedCount>",
-                "Browse", constContentDirService)->setProperty(constIdProperty, id);
+    QObject *cmd=sendCommand("<ObjectID>"+id+"</ObjectID><BrowseFlag>BrowseDirectChildren</BrowseFlag><Filter>*</Filter>"
+                             "<SortCriteria></SortCriteria><StartingIndex>"+QByteArray::number(start)+
+                             "</StartingIndex><RequestedCount>"+QByteArray::number(count)+"</RequestedCount>",
+                             "Browse", constContentDirService, false, prio);
+    if (cmd) {
+        cmd->setProperty(constIdProperty, id);
+        cmd->setProperty(constStartProperty, start);
+        cmd->setProperty(constCountProperty, count);
+    }
+}
+
+/*
+ * Is this the first Browse page that has not yet been added to the model? If so, its objects
+ * can be added as they are received.
+ */
+bool Upnp::MediaServer::isNextPage(const Core::NetworkJob *job) const {
+    QHash<QByteArray, BrowsePages>::ConstIterator it=browsing.constFind(job->property(constIdProperty).toByteArray());
+    return browsing.constEnd()!=it && it.value().next==job->property(constStartProperty).toUInt();
+}
+
+/*
+ * Add any pages that can now be added to the model, and request further pages.
+ */
+void Upnp::MediaServer::continueBrowse(const QByteArray &id) {
+    QHash<QByteArray, BrowsePages>::Iterator it=browsing.find(id);
+    if (browsing.end()==it) {
+        return;
+    }
+    BrowsePages &pages=it.value();
+    bool isRoot=constRootId==id;
+    QPersistentModelIndex parent=findItem(id);
+    if (!parent.isValid() && !isRoot) {
+        // Collection has been removed
+        browsing.erase(it);
+        return;
+    }
+
+    while (pages.received.contains(pages.next)) {
+        QList<DidlObject> objects=pages.received.take(pages.next);
+        if (objects.isEmpty()) {
+            // Page failed, or server returned fewer objects than it said it had
+            pages.total=pages.next;
+            break;
+        }
+        foreach (const DidlObject &obj, objects) {
+            addBrowseItem(obj, parent);
+        }
+        pages.next+=objects.count();
+    }
+
+    if (pages.next>=pages.total) {
+        browsing.erase(it);
+        browseFinished(id, isRoot ? QModelIndex() : findItem(id));
+        return;
+    }
+
+    if (pages.running.contains(pages.next)) {
+        // Next page is still being received, so add what we have so far
+        foreach (Core::NetworkJob *job, jobs) {
+            // Other collections may be browsed at the same time, so match the collection as well as the page
+            ResultParser *parser=job->findChild<ResultParser *>();
+            if (parser && parser->isPage(id, pages.next)) {
+                foreach (const DidlObject &obj, parser->pending) {
+                    addBrowseItem(obj, parser->parent);
+                }
+                parser->pending.clear();
+                break;
+            }
+        }
+    } else if (pages.next<pages.requested) {
+        // Server returned fewer objects than requested, so ask for the rest
+        quint32 end=qMin(pages.requested, pages.total);
+        foreach (quint32 start, pages.running) {
+            if (start>pages.next && start<end) {
+                end=start;
+            }
+        }
+        QMap<quint32, QList<DidlObject> >::ConstIterator r=pages.received.upperBound(pages.next);
+        if (pages.received.constEnd()!=r && r.key()<end) {
+            end=r.key();
+        }
+        pages.running.insert(pages.next);
+        browse(id, pages.next, end-pages.next);
+    }
+
+    // Limit is shared by all collections, but each always has at least one page running - so that it continues
+    int running=0;
+    foreach (const BrowsePages &p, browsing) {
+        running+=p.running.count();
+    }
+    while ((pages.running.isEmpty() || running<constMaxBrowsePages) && pages.requested<pages.total) {
+        running++;
+        quint32 count=qMin(browseChunkSize, pages.total-pages.requested);
+        pages.running.insert(pages.requested);
+        browse(id, pages.requested, count, pages.requested==pages.next ? Prio_Default : Prio_Background);
+        pages.requested+=count;
+    }
+}
+
+void Upnp::MediaServer::browseFinished(const QByteArray &id, const QModelIndex &parent) {
+    Collection *col=parent.isValid() && static_cast<Item *>(parent.internalPointer())->isCollection()
+                    ? static_cast<Collection *>(parent.internalPointer()) : 0;
+    checkCommand(parent);
+
+    if (col) {
+        col->state=State_Populated;
+    } else if (constRootId==id) {
+        state=State_Populated;
+    }
+    if (col || constRootId==id) {
+        emit dataChanged(parent, parent);
+    }
 }
 
 void Upnp::MediaServer::commandResponse(QXmlStreamReader &reader, const QByteArray &type, Core::NetworkJob *job) {
+    Q_UNUSED(job)
     if ("GetSearchCapabilities"==type) {
         parseSearchCapabilities(reader);
-        return;
     } else if ("GetSystemUpdateID"==type) {
         parseSystemUpdateId(reader);
-        return;
     }
-    int total=0;
-    int returned=0;
-    quint32 colUpdateId=0;
-    QModelIndex browseParent;
-    while (!reader.atEnd()) {
-        reader.readNext();
-        if (reader.isStartElement()) {
-            if (QLatin1String("Result")==reader.name()) {
-                QXmlStreamReader result(reader.readElementText());
-                if ("Browse"==type) {
-                    browseParent=parseBrowse(result);
-                } else if ("Search"==type) {
-                    parseSearch(result);
-                }
-            } else if (QLatin1String("NumberReturned")==reader.name()) {
-                returned=reader.readElementText().toUInt();
-            } else if (QLatin1String("TotalMatches")==reader.name()) {
-                total=reader.readElementText().toUInt();
-            } else if (QLatin1String("UpdateID")==reader.name()) {
-                colUpdateId=reader.readElementText().toUInt();
-            }
+}
+
+bool Upnp::MediaServer::streamCommand(const QByteArray &type) const {
+    return "Browse"==type || "Search"==type;
+}
+
+void Upnp::MediaServer::commandData(const QByteArray &type, Core::NetworkJob *job, const QByteArray &data) {
+    ResultParser *parser=job->findChild<ResultParser *>();
+    if (!parser) {
+        parser=new ResultParser(job);
+        if ("Browse"==type) {
+            parser->setPage(job->property(constIdProperty).toByteArray(), job->property(constStartProperty).toUInt());
         }
     }
+    parser->addData(data);
+
+    quint32 before=parser->numObjects();
+    DidlObject obj;
     if ("Browse"==type) {
-        bool isRoot=constRootId==job->property(constIdProperty).toByteArray();
-        if (!browseParent.isValid() && !isRoot) {
-            // If we browse to a collection that has no children, the parseBrowse() will return QModelIndex()
-            // So, if this is the case (and id is *not* for the root colection) then use the id to locate
-            // the actual parent.
-            browseParent=findItem(job->property(constIdProperty).toByteArray(), QModelIndex());
+        bool add=isNextPage(job);
+        if (add && !parser->pending.isEmpty()) {
+            // Page has become the next page, so add the objects held back first
+            foreach (const DidlObject &pendingObj, parser->pending) {
+                addBrowseItem(pendingObj, parser->parent);
+            }
+            parser->pending.clear();
         }
-        Collection *col=browseParent.isValid() && static_cast<Item *>(browseParent.internalPointer())->isCollection()
-                        ? static_cast<Collection *>(browseParent.internalPointer()) : 0;
-        QList<Item *> &list=col ? col->children : items;
-        quint32 skipped = col ? col->numChildrenSkipped : numChildrenSkipped;
-
-        if (0!=colUpdateId) {
-            if (col) {
-                col->updateId=colUpdateId;
-            } else if (isRoot) {
-                updateId=colUpdateId;
+        while (parser->next(obj)) {
+            if (add) {
+                addBrowseItem(obj, parser->parent);
+            } else {
+                parser->pending.append(obj);
             }
-            lastColUpdateId=colUpdateId;
         }
+    } else {
+        while (parser->next(obj)) {
+            addSearchItem(obj, parser->parent);
+        }
+    }
+    if (0==before && parser->numObjects()>0) {
+        // Time from sending the request until the first objects could be shown
+        DBUG(MediaServers) << type << "first" << parser->numObjects() << "objects after" << commandTime(job) << "ms";
+    }
+}
 
-        if ((list.count()+skipped)==total) {
-            checkCommand(browseParent);
+bool Upnp::MediaServer::commandFinished(const QByteArray &type, Core::NetworkJob *job) {
+    ResultParser *parser=job->findChild<ResultParser *>();
+    // If nothing was read, then the command can safely be re-tried
+    if (!parser || (!parser->isComplete() && 0==parser->numObjects())) {
+        return false;
+    }
+    int total=parser->totalMatches();
+    int returned=parser->isComplete() ? parser->numberReturned() : parser->numObjects();
+    quint32 colUpdateId=parser->updateId();
+    DBUG(MediaServers) << type << parser->isComplete() << parser->numObjects() << returned << total;
 
-            if (col) {
-                col->state=State_Populated;
-            } else if (isRoot) {
-                state=State_Populated;
+    if ("Browse"==type) {
+        QByteArray id=job->property(constIdProperty).toByteArray();
+        quint32 start=job->property(constStartProperty).toUInt();
+        quint32 count=job->property(constCountProperty).toUInt();
+        QHash<QByteArray, BrowsePages>::Iterator it=browsing.find(id);
+        if (browsing.end()==it) {
+            // Collection has been cleared, or population was stopped by an earlier failure
+            return true;
+        }
+        BrowsePages &pages=it.value();
+        quint32 numObjects=parser->numObjects();
+        pages.running.remove(start);
+        // TotalMatches follows the results, so is not known if the response was truncated
+        pages.total=qMax(parser->isComplete() ? (quint32)total : pages.total, start+numObjects);
+
+        if (pages.next==start) {
+            // Objects have already been added - apart from any received before this became the next page
+            foreach (const DidlObject &obj, parser->pending) {
+                addBrowseItem(obj, parser->parent);
             }
-            if (col || isRoot) {
-                emit dataChanged(browseParent, browseParent);
+            parser->pending.clear();
+            pages.next+=numObjects;
+            if (0==numObjects) {
+                pages.total=pages.next;
             }
         } else {
-            populate(browseParent, list.count()+skipped);
+            pages.received.insert(start, parser->pending);
+            parser->pending.clear();
+        }
+
+        // Adapt page size to how quickly the server responds
+        qint64 duration=commandTime(job);
+        if (duration<constFastBrowse && numObjects>=count) {
+            browseChunkSize=qMin(browseChunkSize*2, (quint32)constMaxBrowseChunkSize);
+        } else if (duration>constSlowBrowse) {
+            browseChunkSize=qMax(browseChunkSize/2, (quint32)constMinBrowseChunkSize);
         }
+        DBUG(MediaServers) << id << start << numObjects << duration << browseChunkSize;
+
+        if (0!=colUpdateId) {
+            QModelIndex browseParent=findItem(id);
+            Item *item=toItem(browseParent);
+            if (item && item->isCollection()) {
+                static_cast<Collection *>(item)->updateId=colUpdateId;
+            } else if (constRootId==id) {
+                updateId=colUpdateId;
+            }
+            lastColUpdateId=colUpdateId;
+        }
+        continueBrowse(id);
     } else if ("Search"==type) {
+        if (!parser->isComplete()) {
+            // Response was truncated - so just show what we have
+            total=searchStart+returned;
+        }
         if (0==total && 0==returned) {
             emit searching(false);
             emit info(tr("No tracks found!"), Notif_SearchResult, constNotifTimeout);
@@ -568,36 +725,39 @@ void Upnp::MediaServer::commandResponse(QXmlStreamReader &reader, const QByteArr
             }
         }
     }
+    return true;
 }
 
-void Upnp::MediaServer::notification(const QByteArray &sid, const QByteArray &data) {
-    Q_UNUSED(sid)
-    DBUG(MediaServers) << data;
+void Upnp::MediaServer::failedCommand(const QObject *cmd, const QByteArray &type) {
+    if ("Browse"==type) {
+        QByteArray id=cmd->property(constIdProperty).toByteArray();
+        quint32 start=cmd->property(constStartProperty).toUInt();
+        QHash<QByteArray, BrowsePages>::Iterator it=browsing.find(id);
+        if (browsing.end()!=it) {
+            // Show what has been received so far
+            it.value().running.remove(start);
+            it.value().received.insert(start, QList<DidlObject>());
+            continueBrowse(id);
+        }
+    }
+}
 
-    QXmlStreamReader reader(data);
+void Upnp::MediaServer::notification(const QByteArray &sid, const Properties &props) {
+    Q_UNUSED(sid)
     quint32 sysUpdateId=0;
     QStringList containerUpdateIds;
 
-    while (!reader.atEnd()) {
-        reader.readNext();
-        if (reader.isStartElement() && QLatin1String("propertyset")==reader.name()) {
-            while (!reader.atEnd()) {
-                reader.readNext();
-                if (reader.isStartElement() && QLatin1String("property")==reader.name()) {
-                    while (!reader.atEnd()) {
-                        reader.readNext();
-                        if (reader.isStartElement()) {
-                            if (QLatin1String("SystemUpdateID")==reader.name()) {
-                                sysUpdateId=reader.readElementText().toUInt();
-                            } else if (QLatin1String("ContainerUpdateIDs")==reader.name()) {
-                                containerUpdateIds=reader.readElementText().split(',');
-                            }
-                        } else if (reader.isEndElement() && QLatin1String("property")==reader.name()) {
-                            break;
-                        }
-                    }
-                }
-            }
+    foreach (const Property &prop, props) {
+        DBUG(MediaServers) << Property::name(prop.var) << prop.value;
+        switch (prop.var) {
+        case Property::Var_SystemUpdateID:
+            sysUpdateId=prop.value.toUInt();
+            break;
+        case Property::Var_ContainerUpdateIDs:
+            containerUpdateIds=prop.value.split(',');
+            break;
+        default:
+            break;
         }
     }
 
@@ -626,7 +786,7 @@ void Upnp::MediaServer::notification(const QByteArray &sid, const QByteArray &da
                 refresh(QModelIndex());
             } else {
                 // See if we have loaded this id...
-                QModelIndex idx=findItem(id, QModelIndex());
+                QModelIndex idx=findItem(id);
                 if (idx.isValid()) {
                     refresh(idx);
                 }
@@ -707,83 +867,74 @@ static void fixArtist(Upnp::MediaServer::Artist *artist, Upnp::MediaServer::Manu
     }
 }
 
-QModelIndex Upnp::MediaServer::parseBrowse(QXmlStreamReader &reader) {
-    QModelIndex parent;
+void Upnp::MediaServer::addBrowseItem(const DidlObject &obj, QPersistentModelIndex &parentIndex) {
+    QByteArray parentId = obj.value(DidlObject::Field_ParentId).toLatin1();
+    QByteArray id = obj.value(DidlObject::Field_Id).toLatin1();
+    // quint32 childcount = obj.other.value("childCount").toUInt();
 
-    while (!reader.atEnd()) {
-        reader.readNext();
-        if (reader.isStartElement() && QLatin1String("DIDL-Lite")==reader.name()) {
-            while (!reader.atEnd()) {
-                reader.readNext();
-                if (reader.isStartElement() && (QLatin1String("container")==reader.name() ||
-                                                QLatin1String("item")==reader.name())) {
-                    QMap<QString, QString> values=objectValues(reader);
-                    QByteArray parentId = values["parentID"].toLatin1();
-                    QByteArray id = values["id"].toLatin1();
-                    // quint32 childcount = attributes.value("childCount").toString().toUInt();
-
-                    if (!parentId.isEmpty() && !id.isEmpty() && values.contains("class")) {
-                        if (!parent.isValid() || parentId!=itemId(static_cast<Item *>(parent.internalPointer()))) {
-                            parent = findItem(parentId, QModelIndex());
-                        }
-                        if (parent.isValid() || constRootId==parentId) {
-                            Item *item=0;
-                            Item *parentItem=parent.isValid() ? static_cast<Item *>(parent.internalPointer()) : 0;
-                            QString type=values["class"];
-                            QList<Item *> *list=parentItem ? &static_cast<Collection *>(parentItem)->children
-                                                           : &items;
-
-                            DBUG(MediaServers) << type << values["title"] << id << parentId;
-
-                            if (QLatin1String("object.container.storageFolder")==type) {
-                                Folder *folder=new Folder(values["title"], id, parentItem, list->count());
-                                item=folder;
-                                fixFolder(folder, manufacturer);
-                            } else if (QLatin1String("object.container.genre.musicGenre")==type) {
-                                item=new Genre(values["title"], id, parentItem, list->count());
-                            } else if (QLatin1String("object.container.person.musicArtist")==type) {
-                                Artist *artist=new Artist(values["title"], id, parentItem, list->count());
-                                fixArtist(artist, manufacturer);
-                                item=artist;
-                            } else if (QLatin1String("object.container.album.musicAlbum")==type) {
-                                item=new Album(values["title"], values[values.contains("artist") ? "artist" : "creator"],
-                                        albumArt(values["albumArtURI"]), id, parentItem, list->count());
-                            } else if (QLatin1String(constTrackClass)==type ||
-                                       QLatin1String(constBroadcastClass)==type) {
-                                item=new Track(id, values, parentItem, list->count());
-                            } else if (QLatin1String("object.container.playlistContainer")==type) {
-                                item=new Playlist(values["title"], id, parentItem, list->count());
-                            } else if (Man_Minim==manufacturer && QLatin1String("object.container")==type) {
-                                // MinimServer...
-                                if (parentItem && QRegExp("^\\d+ albums$").exactMatch(parentItem->name) && values.contains("albumArtURI")) {
-                                    item=new Album(values["title"], values[values.contains("artist") ? "artist" : "creator"],
-                                                   albumArt(values["albumArtURI"]), id, parentItem, list->count());
-                                } else if (QLatin1String(">> Hide Contents")!=values["title"]) {
-                                    Folder *folder=new Folder(values["title"], id, parentItem, list->count());
-                                    fixFolder(folder, manufacturer);
-                                    item=folder;
-                                }
-                            }
-
-                            if (item) {
-                                DBUG(MediaServers) << item->name << item->type();
-                                beginInsertRows(parent, list->count(), list->count());
-                                list->append(item);
-                                endInsertRows();
-                            } else if (parentItem && parentItem->isCollection()) {
-                                static_cast<Collection *>(parentItem)->numChildrenSkipped++;
-                            } else if (constRootId==parentId) {
-                                numChildrenSkipped++;
-                            }
-                        }
-                    }
-                } else if (reader.isEndElement() && QLatin1String("DIDL-Lite")==reader.name()) {
-                    break;
-                }
-            }
+    if (parentId.isEmpty() || id.isEmpty() || !obj.contains(DidlObject::Field_Class)) {
+        return;
+    }
+
+    QModelIndex parent=parentIndex;
+    if (!parent.isValid() || parentId!=itemId(static_cast<Item *>(parent.internalPointer()))) {
+        parent = findItem(parentId);
+        parentIndex = parent;
+    }
+    if (!parent.isValid() && constRootId!=parentId) {
+        return;
+    }
+
+    Item *item=0;
+    Item *parentItem=parent.isValid() ? static_cast<Item *>(parent.internalPointer()) : 0;
+    const QString &type=obj.value(DidlObject::Field_Class);
+    const QString &title=obj.value(DidlObject::Field_Title);
+    QList<Item *> *list=parentItem ? &static_cast<Collection *>(parentItem)->children
+                                   : &items;
+
+    DBUG(MediaServers) << type << title << id << parentId;
+
+    if (QLatin1String("object.container.storageFolder")==type) {
+        Folder *folder=new Folder(title, id, parentItem, list->count());
+        item=folder;
+        fixFolder(folder, manufacturer);
+    } else if (QLatin1String("object.container.genre.musicGenre")==type) {
+        item=new Genre(title, id, parentItem, list->count());
+    } else if (QLatin1String("object.container.person.musicArtist")==type) {
+        Artist *artist=new Artist(title, id, parentItem, list->count());
+        fixArtist(artist, manufacturer);
+        item=artist;
+    } else if (QLatin1String("object.container.album.musicAlbum")==type) {
+        item=new Album(title, obj.value(obj.contains(DidlObject::Field_Artist) ? DidlObject::Field_Artist : DidlObject::Field_Creator),
+                albumArt(obj.value(DidlObject::Field_AlbumArtUri)), id, parentItem, list->count());
+    } else if (QLatin1String(constTrackClass)==type ||
+               QLatin1String(constBroadcastClass)==type) {
+        item=new Track(id, obj, parentItem, list->count());
+    } else if (QLatin1String("object.container.playlistContainer")==type) {
+        item=new Playlist(title, id, parentItem, list->count());
+    } else if (Man_Minim==manufacturer && QLatin1String("object.container")==type) {
+        // MinimServer...
+        if (parentItem && QRegExp("^\\d+ albums$").exactMatch(parentItem->name) && obj.contains(DidlObject::Field_AlbumArtUri)) {
+            item=new Album(title, obj.value(obj.contains(DidlObject::Field_Artist) ? DidlObject::Field_Artist : DidlObject::Field_Creator),
+                           albumArt(obj.value(DidlObject::Field_AlbumArtUri)), id, parentItem, list->count());
+        } else if (QLatin1String(">> Hide Contents")!=title) {
+            Folder *folder=new Folder(title, id, parentItem, list->count());
+            fixFolder(folder, manufacturer);
+            item=folder;
         }
     }
-    return parent;
+
+    if (item) {
+        DBUG(MediaServers) << item->name << item->type();
+        beginInsertRows(parent, list->count(), list->count());
+        list->append(item);
+        itemIndex.insert(id, item);
+        endInsertRows();
+    } else if (parentItem && parentItem->isCollection()) {
+        static_cast<Collection *>(parentItem)->numChildrenSkipped++;
+    } else if (constRootId==parentId) {
+        numChildrenSkipped++;
+    }
 }
 
 void Upnp::MediaServer::parseSearchCapabilities(QXmlStreamReader &reader) {
@@ -804,83 +955,68 @@ void Upnp::MediaServer::parseSearchCapabilities(QXmlStreamReader &reader) {
     }
 }
 
-void Upnp::MediaServer::parseSearch(QXmlStreamReader &reader) {
-    Album *album=0;
-    QModelIndex albumIndex;
-    while (!reader.atEnd()) {
-        reader.readNext();
-        if (reader.isStartElement()) {
-            if (reader.isStartElement() && QLatin1String("DIDL-Lite")==reader.name()) {
-                while (!reader.atEnd()) {
-                    reader.readNext();
-                    if (reader.isStartElement() && (QLatin1String("container")==reader.name() ||
-                                                    QLatin1String("item")==reader.name())) {
-                        QMap<QString, QString> values=objectValues(reader);
-                        if (QLatin1String(constTrackClass)==values["class"]) {
-                            Track *track=new Track(QByteArray(), values);
-                            Album *use=0;
-                            QModelIndex useIndex;
-                            if (!album || album->name!=track->album || album->artist!=track->artistName()) {
-                                foreach (Item *child, searchItem->children) {
-                                    Album *a=static_cast<Album *>(child);
-                                    if (a->name==track->album) {
-                                        if (a->artist==track->artistName()) {
-                                            use=a;
-                                            useIndex=createIndex(use->row, 0, use);
-                                        } else if (track->albumArtist.isEmpty() && a->artUrl==track->artUrl) {
-                                            use=a;
-                                            a->artist=QObject::tr("Various Artists");
-                                            useIndex=createIndex(use->row, 0, use);
-                                        }
-                                    }
-                                }
-                            } else {
-                                use=album;
-                                useIndex=albumIndex;
-                            }
-
-                            if (!use) {
-                                beginInsertRows(createIndex(searchItem->row, 0, searchItem), searchItem->children.count(), searchItem->children.count());
-                                use=new Album(track->album, track->artistName(), track->artUrl, QByteArray(), searchItem, searchItem->children.count());
-                                use->state=State_Populating;
-                                searchItem->children.append(use);
-                                endInsertRows();
-                                useIndex=createIndex(use->row, 0, use);
-                            }
-                            track->parent=use;
-
-                            // Ensure correct track order! MiniDLNA sometimes has incorrect order!
-                            if (use->children.isEmpty() || track->track>=static_cast<MusicTrack *>(use->children.last())->track) {
-                                track->row=use->children.count();
-                                beginInsertRows(useIndex, use->children.count(), use->children.count());
-                                use->children.append(track);
-                                endInsertRows();
-                            } else {
-                                int numC=use->children.count();
-                                for (int r=0; r<numC; ++r) {
-                                    if (track->track<static_cast<MusicTrack *>(use->children.at(r))->track) {
-                                        track->row=r;
-                                        beginInsertRows(useIndex, r, r);
-                                        use->children.insert(r, track);
-                                        for (int rr=r+1; rr<use->children.count(); ++rr) {
-                                            use->children.at(rr)->row=rr;
-                                        }
-                                        endInsertRows();
-                                        break;
-                                    }
-                                }
-                            }
-                            track->artUrl=QString();
-                            album=use;
-                            albumIndex=useIndex;
-                        }
-                    }
+void Upnp::MediaServer::addSearchItem(const DidlObject &obj, QPersistentModelIndex &albumIndex) {
+    if (!searchItem || QLatin1String(constTrackClass)!=obj.value(DidlObject::Field_Class)) {
+        return;
+    }
+
+    // albumIndex is the album that the previous track was added to
+    Album *album=albumIndex.isValid() ? static_cast<Album *>(albumIndex.internalPointer()) : 0;
+    Track *track=new Track(QByteArray(), obj);
+    Album *use=0;
+    QModelIndex useIndex;
+    if (!album || album->name!=track->album || album->artist!=track->artistName()) {
+        foreach (Item *child, searchItem->children) {
+            Album *a=static_cast<Album *>(child);
+            if (a->name==track->album) {
+                if (a->artist==track->artistName()) {
+                    use=a;
+                    useIndex=createIndex(use->row, 0, use);
+                } else if (track->albumArtist.isEmpty() && a->artUrl==track->artUrl) {
+                    use=a;
+                    a->artist=QObject::tr("Various Artists");
+                    useIndex=createIndex(use->row, 0, use);
+                }
+            }
+        }
+    } else {
+        use=album;
+        useIndex=albumIndex;
+    }
+
+    if (!use) {
+        beginInsertRows(createIndex(searchItem->row, 0, searchItem), searchItem->children.count(), searchItem->children.count());
+        use=new Album(track->album, track->artistName(), track->artUrl, QByteArray(), searchItem, searchItem->children.count());
+        use->state=State_Populating;
+        searchItem->children.append(use);
+        endInsertRows();
+        useIndex=createIndex(use->row, 0, use);
+    }
+    track->parent=use;
+
+    // Ensure correct track order! MiniDLNA sometimes has incorrect order!
+    if (use->children.isEmpty() || track->track>=static_cast<MusicTrack *>(use->children.last())->track) {
+        track->row=use->children.count();
+        beginInsertRows(useIndex, use->children.count(), use->children.count());
+        use->children.append(track);
+        endInsertRows();
+    } else {
+        int numC=use->children.count();
+        for (int r=0; r<numC; ++r) {
+            if (track->track<static_cast<MusicTrack *>(use->children.at(r))->track) {
+                track->row=r;
+                beginInsertRows(useIndex, r, r);
+                use->children.insert(r, track);
+                for (int rr=r+1; rr<use->children.count(); ++rr) {
+                    use->children.at(rr)->row=rr;
                 }
-            } else if (reader.isEndElement() && QLatin1String("DIDL-Lite")==reader.name()) {
+                endInsertRows();
                 break;
             }
         }
     }
+    track->artUrl=QString();
+    albumIndex=useIndex;
 }
 
 void Upnp::MediaServer::parseSystemUpdateId(QXmlStreamReader &reader) {
@@ -910,36 +1046,23 @@ void Upnp::MediaServer::checkSystemUpdateId(quint32 systemUpdateId) {
     }
 }
 
-QModelIndex Upnp::MediaServer::findItem(const QByteArray &id, const QModelIndex &parent) {
-    if (constRootId==id) {
-        return QModelIndex();
-    }
+QModelIndex Upnp::MediaServer::findItem(const QByteArray &id) const {
+    Item *item=itemIndex.value(id);
+    return item ? createIndex(item->row, 0, item) : QModelIndex();
+}
 
-    QList<Item *> *itemList=0;
-    if (parent.isValid()) {
-        Item *parentItem=static_cast<Item *>(parent.internalPointer());
-        if (parentItem->isCollection()) {
-            itemList=&static_cast<Collection *>(parentItem)->children;
+void Upnp::MediaServer::removeFromIndex(const QList<Item *> &list) {
+    QList<Item *> toRemove=list;
+    while (!toRemove.isEmpty()) {
+        Item *item=toRemove.takeLast();
+        const QByteArray &id=itemId(item);
+        if (!id.isEmpty() && itemIndex.value(id)==item) {
+            itemIndex.remove(id);
         }
-    } else {
-        itemList=&items;
-    }
-
-    if (itemList) {
-        for (int r=0; r<itemList->count() ; ++r) {
-            Item *item=itemList->at(r);
-            QModelIndex index=createIndex(r, 0, item);
-            if (itemId(item)==id) {
-                return index;
-            } else if (item->isCollection()) {
-                QModelIndex idx=findItem(id, index);
-                if (idx.isValid()) {
-                    return idx;
-                }
-            }
+        if (item->isCollection()) {
+            toRemove+=static_cast<Collection *>(item)->children;
         }
     }
-    return QModelIndex();
 }
 
 const QList<Upnp::Device::Item *> * Upnp::MediaServer::children(const QModelIndex &index) const {
@@ -1019,7 +1142,7 @@ void Upnp::MediaServer::removeSearchItem() {
         // TODO: Check if command contains search items! If so, then these need to be removed
         beginRemoveRows(QModelIndex(), searchItem->row, searchItem->row);
         items.removeAll(searchItem);
-        delete searchItem;
+        ItemPool::self()->release(searchItem);
         searchItem=0;
         endRemoveRows();
     }
@@ -25,8 +25,10 @@
 #define UPNP_MEDIA_SERVER_H
 
 #include "upnp/device.h"
+#include "upnp/didlobject.h"
 #include "upnp/command.h"
 #include "core/actions.h"
+#include <QSet>
 
 class QTimer;
 class QXmlStreamReader;
@@ -58,6 +60,10 @@ public:
             children.clear();
         }
         virtual bool isCollection() const { return true; }
+        virtual void takeChildren(QList<Item *> &list) {
+            list+=children;
+            children.clear();
+        }
         virtual Core::MonoIcon::Type icon() const { return Core::MonoIcon::folder; }
 
         QList<Item *> children;
@@ -131,7 +137,7 @@ public:
     };
 
     struct Track : public MusicTrack {
-        Track(const QByteArray &i, const QMap<QString, QString> &values, Item *p=0, int r=0);
+        Track(const QByteArray &i, const DidlObject &obj, Item *p=0, int r=0);
         Track(const QString &n=QString(), const QByteArray &i=QByteArray(), Item *p=0, int r=0)
             : MusicTrack(n, p, r), id(i) { }
         virtual ~Track() { }
@@ -155,6 +161,17 @@ public:
 
     static const char * constContentDirService;
 
+    // Browse of a collection. Once the total is known, the remaining pages are requested
+    // concurrently - and then added to the model in order.
+    struct BrowsePages {
+        BrowsePages() : total(0), next(0), requested(0) { }
+        quint32 total;
+        quint32 next;      // Index of next object to be added to the model
+        quint32 requested; // Index following the last page requested
+        QSet<quint32> running; // Start index of pages requested, but not yet received
+        QMap<quint32, QList<DidlObject> > received; // Pages received before preceding pages
+    };
+
     struct PlayCommand : public Command {
         virtual ~PlayCommand() { tracks.clear(); }
         void reset() {
@@ -211,14 +228,24 @@ private:
     void search(quint32 start);
     void populate();
     virtual void populate(const QModelIndex &index, int start=0);
+    bool reconcile();
     void commandResponse(QXmlStreamReader &reader, const QByteArray &type, Core::NetworkJob *job);
-    void notification(const QByteArray &sid, const QByteArray &data);
-    QModelIndex parseBrowse(QXmlStreamReader &reader);
+    bool streamCommand(const QByteArray &type) const;
+    void commandData(const QByteArray &type, Core::NetworkJob *job, const QByteArray &data);
+    bool commandFinished(const QByteArray &type, Core::NetworkJob *job);
+    void failedCommand(const QObject *cmd, const QByteArray &type);
+    void notification(const QByteArray &sid, const Properties &props);
+    void browse(const QByteArray &id, quint32 start, quint32 count, Priority prio=Prio_Default);
+    bool isNextPage(const Core::NetworkJob *job) const;
+    void continueBrowse(const QByteArray &id);
+    void browseFinished(const QByteArray &id, const QModelIndex &parent);
+    void addBrowseItem(const DidlObject &obj, QPersistentModelIndex &parent);
     void parseSearchCapabilities(QXmlStreamReader &reader);
-    void parseSearch(QXmlStreamReader &reader);
+    void addSearchItem(const DidlObject &obj, QPersistentModelIndex &albumIndex);
     void parseSystemUpdateId(QXmlStreamReader &reader);
     void checkSystemUpdateId(quint32 val);
-    QModelIndex findItem(const QByteArray &id, const QModelIndex &parent);
+    QModelIndex findItem(const QByteArray &id) const;
+    void removeFromIndex(const QList<Item *> &list);
     const QList<Item *> * children(const QModelIndex &index) const;
     void populateCommand(const QModelIndex &idx);
     void checkCommand();
@@ -237,9 +264,12 @@ private:
     QTimer *searchTimer;
     QTimer *commandTimer;
     PlayCommand command;
+    QHash<QByteArray, Item *> itemIndex; // Object ID to item, for all loaded items
     quint32 updateId; // UpdateID for root colletion
     quint32 lastColUpdateId; // Last UpdateID received for any collection
     quint32 numChildrenSkipped;
+    QHash<QByteArray, BrowsePages> browsing; // Collection ID to pages
+    quint32 browseChunkSize;
 };
 
 }
@@ -21,15 +21,19 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include "core/configuration.h"
 #include "core/debug.h"
 #include "core/thread.h"
 #include "core/globalstatic.h"
 #include "core/networkaccessmanager.h"
 #include "upnp/httpserver.h"
+#include "upnp/mediaserver.h"
 #include "upnp/mediaservers.h"
 #include "upnp/model.h"
+#include "upnp/ohrenderer.h"
 #include "upnp/renderers.h"
 #include "upnp/ssdp.h"
+#include "upnp/subscriptions.h"
 #include <QCommandLineParser>
 #include <QThread>
 #include <QTimer>
@@ -46,6 +50,8 @@ Upnp::Model::Model() {
     renderers=new Upnp::Renderers(http, this);
     network->moveToThread(ssdpThread);
     ssdp->setNetwork(network);
+    ssdp->setServiceTypes(QList<QByteArray>() << MediaServer::constContentDirService << OhRenderer::constPlaylistService,
+                          Core::Configuration(ssdp).get("targetedSearch", true));
     ssdp->moveToThread(ssdpThread);
     http->moveToThread(httpThread);
     ssdpThread->start();
@@ -56,8 +62,7 @@ Upnp::Model::Model() {
     connect(ssdp, SIGNAL(deviceAdded(Ssdp::Device)), renderers, SLOT(added(Ssdp::Device)));
     connect(ssdp, SIGNAL(deviceRemoved(QByteArray)), renderers, SLOT(removed(QByteArray)));
     connect(ssdp, SIGNAL(connectionStateChanged(bool)), renderers, SLOT(connectionStateChanged(bool)));
-    connect(http, SIGNAL(notification(QByteArray,QByteArray,int)), servers, SLOT(notification(QByteArray,QByteArray,int)));
-    connect(http, SIGNAL(notification(QByteArray,QByteArray,int)), renderers, SLOT(notification(QByteArray,QByteArray,int)));
+    connect(http, SIGNAL(notification(QByteArray,Upnp::Properties,int)), Subscriptions::self(), SLOT(notification(QByteArray,Upnp::Properties,int)));
     connect(ssdpThread, SIGNAL(started()), ssdp, SLOT(start()));
     connect(httpThread, SIGNAL(started()), http, SLOT(start()));
     connect(servers, SIGNAL(addTracks(Upnp::Command*)), renderers, SLOT(addTracks(Upnp::Command*)));
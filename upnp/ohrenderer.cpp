@@ -23,6 +23,8 @@
 
 #include "upnp/ohrenderer.h"
 #include "upnp/command.h"
+#include "upnp/didlobject.h"
+#include "upnp/itempool.h"
 #include "core/debug.h"
 #include <QXmlStreamReader>
 #include <QXmlStreamWriter>
@@ -37,9 +39,8 @@ static const char * constProductService="urn:av-openhome-org:service:Product:1";
 static const char * constVolumeService="urn:av-openhome-org:service:Volume:1";
 static const int constReadListSize = 20;
 
-static QList<quint32> decodeIds(QXmlStreamReader &reader) {
+static QList<quint32> decodeIds(const QByteArray &encoded) {
     QList<quint32> ids;
-    QByteArray encoded=reader.readElementText().toLatin1();
     QByteArray idArray=QByteArray::fromBase64(encoded);
     if (idArray.toBase64()==encoded && 0==idArray.length()%4) {
         const char *data=idArray.constData();
@@ -114,6 +115,39 @@ void Upnp::OhRenderer::populate() {
     }
 }
 
+bool Upnp::OhRenderer::reconcile() {
+    DBUG(Renderers);
+    // IdArray response is diffed against current items, so only new tracks are read
+    sendCommand("", "SourceIndex", constProductService);
+    sendCommand("", "IdArray", constPlaylistService);
+    sendCommand("", "Id", constPlaylistService);
+    sendCommand("", "Repeat", constPlaylistService);
+    sendCommand("", "Shuffle", constPlaylistService);
+    sendCommand("", "TransportState", constPlaylistService);
+    sendCommand("", "Volume", constVolumeService);
+    sendCommand("", "Mute", constVolumeService);
+    return true;
+}
+
+void Upnp::OhRenderer::resync(const QByteArray &service) {
+    DBUG(Renderers) << service;
+    if (constPlaylistService==service) {
+        sendCommand("", "IdArray", constPlaylistService);
+        sendCommand("", "Id", constPlaylistService);
+        sendCommand("", "Repeat", constPlaylistService);
+        sendCommand("", "Shuffle", constPlaylistService);
+        sendCommand("", "TransportState", constPlaylistService);
+    } else if (constVolumeService==service) {
+        sendCommand("", "Volume", constVolumeService);
+        sendCommand("", "VolumeLimit", constVolumeService);
+        sendCommand("", "Mute", constVolumeService);
+    } else if (constProductService==service) {
+        sendCommand("", "SourceIndex", constProductService);
+        sendCommand("", "SourceXml", constProductService);
+    }
+    // Others (e.g. Time) are frequently updated, so next event will correct state
+}
+
 void Upnp::OhRenderer::commandResponse(QXmlStreamReader &reader, const QByteArray &type, Core::NetworkJob *job) {
     Q_UNUSED(job)
     // TODO: Radio service? Currently disabled in constructor. Need to map URL from job to obtain service type
@@ -134,8 +168,7 @@ void Upnp::OhRenderer::commandResponse(QXmlStreamReader &reader, const QByteArra
     } else if ("SourceIndex"==type) {
         handleSourceIndex(getValue(reader).toUInt());
     } else if ("SourceXml"==type) {
-        QXmlStreamReader xmlReader(getValue(reader));
-        handleSourceXml(xmlReader);
+        handleSources(Property::parseSources(getValue(reader)));
     } else if ("DeleteAll"==type && currentCmd && Command::ReplaceAndPlay==currentCmd->type) {
         addTrack(0);
     } else if ("Volume"==type) {
@@ -147,9 +180,9 @@ void Upnp::OhRenderer::commandResponse(QXmlStreamReader &reader, const QByteArra
     }
 }
 
-void Upnp::OhRenderer::failedCommand(Core::NetworkJob *job, const QByteArray &type) {
+void Upnp::OhRenderer::failedCommand(const QObject *cmd, const QByteArray &type) {
     DBUG(Renderers) << type;
-    Q_UNUSED(job)
+    Q_UNUSED(cmd)
     if ("Insert"==type || "DeleteAll"==type) {
         if (currentCmd) {
             if (Command::ReplaceAndPlay==currentCmd->type) {
@@ -161,71 +194,69 @@ void Upnp::OhRenderer::failedCommand(Core::NetworkJob *job, const QByteArray &ty
     }
 }
 
-void Upnp::OhRenderer::notification(const QByteArray &sid, const QByteArray &data) {
+void Upnp::OhRenderer::notification(const QByteArray &sid, const Properties &props) {
     // TODO: Radio service? Currently disabled in constructor
     Q_UNUSED(sid)
-    DBUG(Renderers) << data;
-    QXmlStreamReader reader(data);
-    while (!reader.atEnd()) {
-        reader.readNext();
-         if (reader.isStartElement() && QLatin1String("propertyset")==reader.name()) {
-             while (!reader.atEnd()) {
-                 reader.readNext();
-                  if (reader.isStartElement() && QLatin1String("property")==reader.name()) {
-                      while (!reader.atEnd()) {
-                          reader.readNext();
-                           if (reader.isStartElement()) {
-                                if (QLatin1String("Seconds")==reader.name()) {
-                                    quint32 val=reader.readElementText().toUInt();
-                                    if (val!=playState.seconds) {
-                                        playState.seconds=val;
-                                        emit playbackPos(playState.seconds);
-                                    }
-                                } else if (QLatin1String("Duration")==reader.name()) {
-                                    quint32 val=reader.readElementText().toUInt();
-                                    if (val!=playState.duration) {
-                                        playState.duration=val;
-                                        emit playbackDuration(playState.duration);
-                                    }
-                                } else if (QLatin1String("IdArray")==reader.name()) {
-                                    updateTracks(decodeIds(reader));
-                                } else if (QLatin1String("Id")==reader.name()) {
-                                    updateCurrentTrackId(reader.readElementText());
-                                } else if (QLatin1String("Repeat")==reader.name()) {
-                                    updateRepeat(reader.readElementText());
-                                } else if (QLatin1String("Shuffle")==reader.name()) {
-                                    updateShuffle(reader.readElementText());
-                                } else if (QLatin1String("TracksMax")==reader.name()) {
-                                    ;
-                                } else if (QLatin1String("VolumeSteps")==reader.name()) {
-                                    quint32 val=reader.readElementText().toUInt();
-                                    if (val!=volState.steps) {
-                                        volState.steps=val;
-                                        emit volumeState(volState);
-                                    }
-                                } else if (QLatin1String("VolumeLimit")==reader.name()) {
-                                    updateVolumeLimit(reader.readElementText());
-                                } else if (QLatin1String("Volume")==reader.name()) {
-                                    updateVolume(reader.readElementText());
-                                } else if (QLatin1String("Mute")==reader.name()) {
-                                    updateMute(reader.readElementText());
-                                } else if (QLatin1String("TransportState")==reader.name()) {
-                                    updateTransportState(reader.readElementText());
-                                } else if (QLatin1String("Uri")==reader.name()) {
-                                    ; // qWarning() << "Uri:" << reader.readElementText();
-                                } else if (QLatin1String("SourceIndex")==reader.name()) {
-                                    handleSourceIndex(reader.readElementText().toUInt());
-                                } else if (QLatin1String("SourceXml")==reader.name()) {
-                                    QXmlStreamReader xmlReader(reader.readElementText());
-                                    handleSourceXml(xmlReader);
-                                }
-                           } else if (reader.isEndElement() && QLatin1String("property")==reader.name()) {
-                               break;
-                           }
-                      }
-                  }
-             }
-         }
+    foreach (const Property &prop, props) {
+        DBUG(Renderers) << Property::name(prop.var) << prop.value;
+        switch (prop.var) {
+        case Property::Var_Seconds: {
+            quint32 val=prop.value.toUInt();
+            if (val!=playState.seconds) {
+                playState.seconds=val;
+                emit playbackPos(playState.seconds);
+            }
+            break;
+        }
+        case Property::Var_Duration: {
+            quint32 val=prop.value.toUInt();
+            if (val!=playState.duration) {
+                playState.duration=val;
+                emit playbackDuration(playState.duration);
+            }
+            break;
+        }
+        case Property::Var_IdArray:
+            updateTracks(decodeIds(prop.value.toLatin1()));
+            break;
+        case Property::Var_Id:
+            updateCurrentTrackId(prop.value);
+            break;
+        case Property::Var_Repeat:
+            updateRepeat(prop.value);
+            break;
+        case Property::Var_Shuffle:
+            updateShuffle(prop.value);
+            break;
+        case Property::Var_VolumeSteps: {
+            quint32 val=prop.value.toUInt();
+            if (val!=volState.steps) {
+                volState.steps=val;
+                emit volumeState(volState);
+            }
+            break;
+        }
+        case Property::Var_VolumeLimit:
+            updateVolumeLimit(prop.value);
+            break;
+        case Property::Var_Volume:
+            updateVolume(prop.value);
+            break;
+        case Property::Var_Mute:
+            updateMute(prop.value);
+            break;
+        case Property::Var_TransportState:
+            updateTransportState(prop.value);
+            break;
+        case Property::Var_SourceIndex:
+            handleSourceIndex(prop.value.toUInt());
+            break;
+        case Property::Var_SourceXml:
+            handleSources(prop.sources);
+            break;
+        default: // TracksMax, Uri
+            break;
+        }
     }
 }
 
@@ -321,7 +352,7 @@ void Upnp::OhRenderer::handleIdArray(QXmlStreamReader &reader) {
     while (!reader.atEnd()) {
         reader.readNext();
         if (reader.isStartElement() && QLatin1String("Array")==reader.name()) {
-            updateTracks(decodeIds(reader));
+            updateTracks(decodeIds(reader.readElementText().toLatin1()));
             return;
         }
     }
@@ -368,30 +399,7 @@ void Upnp::OhRenderer::handleSourceIndex(quint32 val) {
     }
 }
 
-void Upnp::OhRenderer::handleSourceXml(QXmlStreamReader &reader) {
-    QList<Source> src;
-    while (!reader.atEnd()) {
-        reader.readNext();
-        if (reader.isStartElement() && QLatin1String("Source")==reader.name()) {
-            Source s;
-            while (!reader.atEnd()) {
-                reader.readNext();
-                if (reader.isStartElement()) {
-                    if (QLatin1String("Name")==reader.name()) {
-                        s.name=reader.readElementText();
-                    } else if (QLatin1String("Type")==reader.name()) {
-                        s.type=reader.readElementText();
-                    } else if (QLatin1String("Name")==reader.name()) {
-                        s.visible=toBool(reader.readElementText());
-                    }
-                } else if (reader.isEndElement() && QLatin1String("Source")==reader.name()) {
-                    src.append(s);
-                    break;
-                }
-            }
-        }
-    }
-
+void Upnp::OhRenderer::handleSources(const Sources &src) {
     if (sources!=src || sourceIndex>=sources.count()) {
         DBUG(Renderers) << "sourceXml changed";
         sources=src;
@@ -469,6 +477,7 @@ void Upnp::OhRenderer::handleReadList(QXmlStreamReader &reader) {
                                 track->artUrl=meta.artUrl;
                                 track->isBroadcast=meta.isBroadcast;
                                 track->res=meta.res;
+                                track->didl=meta.didl;
                                 QModelIndex idx=createIndex(row, 0, track);
                                 emit dataChanged(idx, idx);
 
@@ -504,7 +513,7 @@ void Upnp::OhRenderer::updateTracks(const QList<quint32> &update) {
 
     if (items.isEmpty() || update.isEmpty() || update.count()>8192) {
         beginResetModel();
-        qDeleteAll(items);
+        ItemPool::self()->release(items);
         items.clear();
         foreach (const quint32 &id, update) {
             items.append(new Track(id, tr("Track %1").arg(items.count()+1)));
@@ -555,25 +564,28 @@ void Upnp::OhRenderer::updateTracks(const QList<quint32> &update) {
 //        }
     }
 
+    // Only the first page of details is likely to be visible, so fetch the rest in the background
     QList<QByteArray> toSend;
+    Priority prio=Prio_Visible;
     foreach (const quint32 &id, needDetails) {
         toSend.append(QByteArray::number(id));
         if (constReadListSize==toSend.count()) {
-            sendCommand("<IdList>"+toSend.join(' ')+"</IdList>", "ReadList", constPlaylistService);
+            sendCommand("<IdList>"+toSend.join(' ')+"</IdList>", "ReadList", constPlaylistService, false, prio);
             toSend.clear();
+            prio=Prio_Background;
         }
     }
     if (!toSend.isEmpty()) {
-        sendCommand("<IdList>"+toSend.join(' ')+"</IdList>", "ReadList", constPlaylistService);
+        sendCommand("<IdList>"+toSend.join(' ')+"</IdList>", "ReadList", constPlaylistService, false, prio);
     }
     ids=newIds;
     updateStats();
     sendCommand("", "Id", constPlaylistService);
 }
 
-QMap<QString, QString> Upnp::OhRenderer::parseTrackMetadata(const QString &xml) {
+Upnp::DidlObject Upnp::OhRenderer::parseTrackMetadata(const QString &xml) {
     QXmlStreamReader reader(xml);
-    QMap<QString, QString> meta;
+    DidlObject meta;
 
     while (!reader.atEnd()) {
         reader.readNext();
@@ -581,7 +593,7 @@ QMap<QString, QString> Upnp::OhRenderer::parseTrackMetadata(const QString &xml)
             while (!reader.atEnd()) {
                 reader.readNext();
                 if (reader.isStartElement() && QLatin1String("item")==reader.name()) {
-                    meta=objectValues(reader);
+                    meta=DidlObject::read(reader, xml);
                     break;
                 }
             }
@@ -636,7 +648,7 @@ void Upnp::OhRenderer::stop() {
 
 void Upnp::OhRenderer::seek(quint32 pos) {
     DBUG(Renderers) << pos;
-    sendCommand(valueStr(pos), "SeekSecondAbsolute", constPlaylistService);
+    sendLatestCommand(valueStr(pos), "SeekSecondAbsolute", constPlaylistService);
 }
 
 void Upnp::OhRenderer::setRepeat(bool r) {
@@ -661,7 +673,7 @@ void Upnp::OhRenderer::mute(bool m) {
 
 void Upnp::OhRenderer::setVolume(int vol) {
     DBUG(Renderers) << vol;
-    sendCommand(valueStr(vol), "SetVolume", constVolumeService);
+    sendLatestCommand(valueStr(vol), "SetVolume", constVolumeService);
 }
 
 void Upnp::OhRenderer::addTracks(Command *cmd) {
@@ -33,15 +33,6 @@ class OhRenderer : public Renderer {
     Q_OBJECT
 
 public:
-    struct Source {
-        Source(const QString &n=QString(), const QString &t=QString(), bool v=false)
-            : name(n), type(t), visible(v) { }
-        bool operator ==(const Source &o) const { return visible==o.visible && name==o.name && type==o.type; }
-        QString name;
-        QString type;
-        bool visible;
-    };
-
     static const char * constPlaylistService;
     static const char * constRadioService;
     static const char * constReceiverService;
@@ -57,9 +48,11 @@ private:
     void setActive(bool a);
     void clear();
     void populate();
+    bool reconcile();
+    void resync(const QByteArray &service);
     void commandResponse(QXmlStreamReader &reader, const QByteArray &type, Core::NetworkJob *job);
-    void failedCommand(Core::NetworkJob *job, const QByteArray &type);
-    void notification(const QByteArray &sid, const QByteArray &data);
+    void failedCommand(const QObject *cmd, const QByteArray &type);
+    void notification(const QByteArray &sid, const Properties &props);
     void updateTransportState(const QString &val);
     void updateCurrentTrackId(const QString &val);
     void updateShuffle(const QString &val);
@@ -70,12 +63,12 @@ private:
     void handleIdArray(QXmlStreamReader &reader);
     void handleInsert(QXmlStreamReader &reader);
     void handleSourceIndex(quint32 val);
-    void handleSourceXml(QXmlStreamReader &reader);
+    void handleSources(const Sources &src);
     QString getValue(QXmlStreamReader &reader);
     void handleReadList(QXmlStreamReader &reader);
     qint32 getRowById(quint32 id) const;
     void updateTracks(const QList<quint32> &update);
-    QMap<QString, QString> parseTrackMetadata(const QString &xml);
+    DidlObject parseTrackMetadata(const QString &xml);
     void updateCurrentTrackId(quint32 id);
     QModelIndex current();
     void previous();
@@ -102,7 +95,7 @@ private:
     int addedCount;
     QSet<quint32> ids;
     qint32 sourceIndex;
-    QList<Source> sources;
+    Sources sources;
 };
 
 }
@@ -0,0 +1,126 @@
+/*
+ * Madrigal
+ *
+ * Copyright (c) 2016 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "upnp/property.h"
+#include <QXmlStreamReader>
+
+static const char * constNames[Upnp::Property::Var_Count]={
+    "",
+    "Seconds",
+    "Duration",
+    "IdArray",
+    "Id",
+    "Repeat",
+    "Shuffle",
+    "TracksMax",
+    "VolumeSteps",
+    "VolumeLimit",
+    "Volume",
+    "Mute",
+    "TransportState",
+    "Uri",
+    "SourceIndex",
+    "SourceXml",
+    "SystemUpdateID",
+    "ContainerUpdateIDs"
+};
+
+static Upnp::Property::Variable toVariable(const QStringRef &name) {
+    for (int i=Upnp::Property::Var_Unknown+1; i<Upnp::Property::Var_Count; ++i) {
+        if (QLatin1String(constNames[i])==name) {
+            return (Upnp::Property::Variable)i;
+        }
+    }
+    return Upnp::Property::Var_Unknown;
+}
+
+const char * Upnp::Property::name(Variable v) {
+    return v>Var_Unknown && v<Var_Count ? constNames[v] : "";
+}
+
+/*
+ * Parse a GENA property set. Only variables that we handle are returned, in the
+ * order in which they were received.
+ */
+Upnp::Properties Upnp::Property::parse(const QByteArray &data) {
+    Properties props;
+    QXmlStreamReader reader(data);
+
+    while (!reader.atEnd()) {
+        reader.readNext();
+        if (reader.isStartElement() && QLatin1String("propertyset")==reader.name()) {
+            while (!reader.atEnd()) {
+                reader.readNext();
+                if (reader.isStartElement() && QLatin1String("property")==reader.name()) {
+                    while (!reader.atEnd()) {
+                        reader.readNext();
+                        if (reader.isStartElement()) {
+                            Variable var=toVariable(reader.name());
+                            if (Var_Unknown==var) {
+                                reader.skipCurrentElement();
+                            } else {
+                                Property prop(var, reader.readElementText());
+                                if (Var_SourceXml==var) {
+                                    prop.sources=parseSources(prop.value);
+                                }
+                                props.append(prop);
+                            }
+                        } else if (reader.isEndElement() && QLatin1String("property")==reader.name()) {
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return props;
+}
+
+Upnp::Sources Upnp::Property::parseSources(const QString &xml) {
+    Sources sources;
+    QXmlStreamReader reader(xml);
+
+    while (!reader.atEnd()) {
+        reader.readNext();
+        if (reader.isStartElement() && QLatin1String("Source")==reader.name()) {
+            Source s;
+            while (!reader.atEnd()) {
+                reader.readNext();
+                if (reader.isStartElement()) {
+                    if (QLatin1String("Name")==reader.name()) {
+                        s.name=reader.readElementText();
+                    } else if (QLatin1String("Type")==reader.name()) {
+                        s.type=reader.readElementText();
+                    } else if (QLatin1String("Visible")==reader.name()) {
+                        QString val=reader.readElementText();
+                        s.visible=QLatin1String("true")==val || QLatin1String("1")==val;
+                    }
+                } else if (reader.isEndElement() && QLatin1String("Source")==reader.name()) {
+                    sources.append(s);
+                    break;
+                }
+            }
+        }
+    }
+    return sources;
+}
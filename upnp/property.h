@@ -0,0 +1,90 @@
+/*
+ * Madrigal
+ *
+ * Copyright (c) 2016 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef UPNP_PROPERTY_H
+#define UPNP_PROPERTY_H
+
+#include <QList>
+#include <QString>
+#include <QMetaType>
+
+namespace Upnp {
+
+// Entry of an OpenHome Product service's SourceXml
+struct Source {
+    Source(const QString &n=QString(), const QString &t=QString(), bool v=false)
+        : name(n), type(t), visible(v) { }
+    bool operator ==(const Source &o) const { return visible==o.visible && name==o.name && type==o.type; }
+    QString name;
+    QString type;
+    bool visible;
+};
+
+typedef QList<Source> Sources;
+
+// Evented state variable, as parsed from a GENA property set
+struct Property {
+    enum Variable {
+        Var_Unknown,
+
+        // OpenHome
+        Var_Seconds,
+        Var_Duration,
+        Var_IdArray,
+        Var_Id,
+        Var_Repeat,
+        Var_Shuffle,
+        Var_TracksMax,
+        Var_VolumeSteps,
+        Var_VolumeLimit,
+        Var_Volume,
+        Var_Mute,
+        Var_TransportState,
+        Var_Uri,
+        Var_SourceIndex,
+        Var_SourceXml,
+
+        // ContentDirectory
+        Var_SystemUpdateID,
+        Var_ContainerUpdateIDs,
+
+        Var_Count
+    };
+
+    static QList<Property> parse(const QByteArray &data);
+    static Sources parseSources(const QString &xml);
+    static const char * name(Variable v);
+
+    Property(Variable v=Var_Unknown, const QString &val=QString()) : var(v), value(val) { }
+    Variable var;
+    QString value;
+    Sources sources; // Var_SourceXml only, parsed along with the property set
+};
+
+typedef QList<Property> Properties;
+
+}
+
+Q_DECLARE_METATYPE(Upnp::Properties)
+
+#endif
@@ -58,8 +58,8 @@ public:
     };
 
     struct Track : public MusicTrack {
-        Track(quint32 i, const QMap<QString, QString> &values, Item *p=0, int r=0)
-            : MusicTrack(values, p, r), id(i) { }
+        Track(quint32 i, const DidlObject &obj, Item *p=0, int r=0)
+            : MusicTrack(obj, p, r), id(i) { }
         Track(quint32 i=0, const QString &n=QString(), Item *p=0, int r=0)
             : MusicTrack(n, p, r), id(i) { }
         virtual ~Track() { }
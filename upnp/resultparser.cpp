@@ -0,0 +1,196 @@
+/*
+ * Madrigal
+ *
+ * Copyright (c) 2016 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "upnp/resultparser.h"
+#include "core/debug.h"
+
+Upnp::ResultParser::ResultParser(QObject *parent)
+    : QObject(parent)
+    , inResult(false)
+    , complete(false)
+    , returned(0)
+    , total(0)
+    , colUpdateId(0)
+    , objects(0)
+    , pageStart(0)
+    , depth(0)
+    , field(DidlObject::Field_Unknown)
+    , bufferOffset(0)
+    , rawStart(-1)
+    , keepRaw(false)
+{
+}
+
+void Upnp::ResultParser::addData(const QByteArray &data) {
+    if (!data.isEmpty()) {
+        envelope.addData(data);
+    }
+}
+
+/*
+ * Read the next complete container, or item, from the response. Values are stored in the
+ * same manner as DidlObject::read(). Returns false if more data is required.
+ */
+bool Upnp::ResultParser::next(DidlObject &obj) {
+    forever {
+        if (readObject(obj)) {
+            objects++;
+            return true;
+        }
+        if (!readEnvelope()) {
+            return false;
+        }
+    }
+}
+
+/*
+ * Read SOAP envelope until some of the DIDL-Lite result has been passed to the second reader.
+ * Returns false if more data is required, or the envelope has been completely read.
+ */
+bool Upnp::ResultParser::readEnvelope() {
+    while (!complete) {
+        QXmlStreamReader::TokenType token=envelope.readNext();
+        switch (token) {
+        case QXmlStreamReader::Invalid:
+            if (QXmlStreamReader::PrematureEndOfDocumentError!=envelope.error()) {
+                DBUG(MediaServers) << envelope.errorString();
+                complete=true;
+            }
+            return false;
+        case QXmlStreamReader::EndDocument:
+            complete=true;
+            break;
+        case QXmlStreamReader::StartElement:
+            element=envelope.name().toString();
+            inResult=QLatin1String("Result")==element;
+            text.clear();
+            break;
+        case QXmlStreamReader::Characters:
+            if (inResult) {
+                QString chunk=envelope.text().toString();
+                didl.addData(chunk);
+                buffer+=chunk;
+                return true;
+            }
+            text+=envelope.text();
+            break;
+        case QXmlStreamReader::EndElement:
+            if (inResult) {
+                inResult=false;
+            } else if (QLatin1String("NumberReturned")==element) {
+                returned=text.toUInt();
+            } else if (QLatin1String("TotalMatches")==element) {
+                total=text.toUInt();
+            } else if (QLatin1String("UpdateID")==element) {
+                colUpdateId=text.toUInt();
+            }
+            element.clear();
+            break;
+        default:
+            break;
+        }
+    }
+    return false;
+}
+
+/*
+ * Read tokens from DIDL-Lite reader. As the reader may run out of data at any point, the state
+ * of the object currently being read is kept in member variables.
+ */
+bool Upnp::ResultParser::readObject(DidlObject &obj) {
+    forever {
+        QXmlStreamReader::TokenType token=didl.readNext();
+        switch (token) {
+        case QXmlStreamReader::Invalid:
+            if (QXmlStreamReader::PrematureEndOfDocumentError!=didl.error()) {
+                DBUG(MediaServers) << didl.errorString();
+            }
+            return false;
+        case QXmlStreamReader::EndDocument:
+            return false;
+        case QXmlStreamReader::StartElement:
+            if (0==depth) {
+                if (QLatin1String("container")==didl.name() || QLatin1String("item")==didl.name()) {
+                    depth=1;
+                    current.clear();
+                    rawStart=-1;
+                    if (QLatin1String("item")==didl.name()) {
+                        // Attributes cannot contain '<', so the last one before the current position starts this element
+                        int pos=buffer.lastIndexOf(QLatin1Char('<'), didl.characterOffset()-bufferOffset-1);
+                        rawStart=pos<0 ? -1 : bufferOffset+pos;
+                    }
+                    keepRaw=rawStart>=0 && DidlObject::hasStandardNames(didl);
+                    foreach (const QXmlStreamAttribute &attr, didl.attributes()) {
+                        current.insert(attr.name(), attr.value().toString());
+                    }
+                }
+            } else {
+                keepRaw=keepRaw && DidlObject::hasStandardNames(didl);
+                if (1==depth++) {
+                    field=DidlObject::toField(didl.name());
+                    value.clear();
+                    if (DidlObject::Field_Artist==field) {
+                        if (didl.attributes().value(QLatin1String("role"))==QLatin1String("AlbumArtist")) {
+                            field=DidlObject::Field_AlbumArtist;
+                        }
+                    } else if (DidlObject::Field_Res==field) {
+                        foreach (const QXmlStreamAttribute &attr, didl.attributes()) {
+                            current.insertRes(attr.name(), attr.value().toString());
+                        }
+                    } else if (DidlObject::Field_Unknown==field) {
+                        key=didl.name().toString();
+                    }
+                }
+            }
+            break;
+        case QXmlStreamReader::Characters:
+            if (2==depth) {
+                value+=didl.text();
+            }
+            break;
+        case QXmlStreamReader::EndElement:
+            if (depth>0) {
+                if (2==depth) {
+                    if (DidlObject::Field_Unknown==field) {
+                        current.other.insert(key, value);
+                    } else {
+                        current.insert(field, value);
+                    }
+                }
+                if (0==--depth) {
+                    qint64 end=didl.characterOffset();
+                    if (keepRaw) {
+                        current.setRaw(buffer, rawStart-bufferOffset, end-bufferOffset);
+                    }
+                    buffer.remove(0, end-bufferOffset);
+                    bufferOffset=end;
+                    obj=current;
+                    return true;
+                }
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
@@ -0,0 +1,96 @@
+/*
+ * Madrigal
+ *
+ * Copyright (c) 2016 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef UPNP_RESULT_PARSER_H
+#define UPNP_RESULT_PARSER_H
+
+#include "upnp/didlobject.h"
+#include <QObject>
+#include <QXmlStreamReader>
+#include <QPersistentModelIndex>
+
+namespace Upnp {
+
+/*
+ * Incremental parser for Browse and Search responses. The SOAP envelope is parsed as data
+ * arrives, and the escaped DIDL-Lite contained in <Result> is fed into a second reader - so
+ * that objects can be added to the model whilst the response is still being downloaded.
+ *
+ * Parser is created as a child of the NetworkJob, so that it is removed along with the job.
+ */
+class ResultParser : public QObject {
+    Q_OBJECT
+
+public:
+    ResultParser(QObject *parent);
+    virtual ~ResultParser() { }
+
+    void addData(const QByteArray &data);
+    bool next(DidlObject &obj);
+    bool isComplete() const { return complete; }
+    quint32 numObjects() const { return objects; }
+    quint32 numberReturned() const { return returned; }
+    quint32 totalMatches() const { return total; }
+    quint32 updateId() const { return colUpdateId; }
+    void setPage(const QByteArray &id, quint32 start) { pageId=id; pageStart=start; }
+    bool isPage(const QByteArray &id, quint32 start) const { return !pageId.isEmpty() && pageId==id && pageStart==start; }
+
+    // Last parent (Browse), or album (Search), that an object was added to
+    QPersistentModelIndex parent;
+    // Objects that cannot yet be added, as preceding Browse pages have not been received
+    QList<DidlObject> pending;
+
+private:
+    bool readEnvelope();
+    bool readObject(DidlObject &obj);
+
+private:
+    QXmlStreamReader envelope;
+    QXmlStreamReader didl;
+    bool inResult;
+    bool complete;
+    QString element;
+    QString text;
+    quint32 returned;
+    quint32 total;
+    quint32 colUpdateId;
+    quint32 objects;
+    // Browse page being parsed - collection ID, and index of its first object
+    QByteArray pageId;
+    quint32 pageStart;
+    // Object currently being read
+    int depth;
+    DidlObject current;
+    DidlObject::Field field;
+    QString key; // Name of unknown element
+    QString value;
+    // DIDL-Lite text that has not yet been completely read, used to store the original XML of items
+    QString buffer;
+    qint64 bufferOffset;
+    qint64 rawStart;
+    bool keepRaw;
+};
+
+}
+
+#endif
@@ -22,28 +22,50 @@
  */
 
 #include "upnp/ssdp.h"
+#include "upnp/ssdpmessage.h"
 #include "core/debug.h"
 #include "core/networkaccessmanager.h"
+#include "core/utils.h"
+#include "core/configuration.h"
 #include "config.h"
 #include <QByteArray>
+#include <QDataStream>
 #include <QHostAddress>
 #include <QUdpSocket>
 #include <QNetworkConfigurationManager>
+#include <QNetworkInterface>
+#include <QHostInfo>
 #include <QXmlStreamReader>
 #include <QTimer>
 #include <QFile>
 #ifdef Q_OS_LINUX
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
 #endif
 
 #define LINE_SEP "\r\n"
 
 static const quint16 constPort = 1900;
 static const char *constMulticastGroup = "239.255.255.250";
+static const char *constMulticastGroup6 = "FF02::C";
 static const char * constUuidProp="uuid";
+static const char * constRootDevice="upnp:rootdevice";
+static const char * constStaticPrefix="static:";
 static const int constBackgroundSearchPeriod=30*1000;
 static const int constUrgentSearchPeriod=10*1000;
+static const char * constCacheDir="ssdp";
+static const char * constCacheFile="devices";
+static const quint32 constCacheVersion=1;
+static const int constCacheMaxAge=30; // Days
+static const int constExpiryGrace=10*1000;
+static const int constExpiryTick=5*1000;
+static const int constExpirySlots=64;
+static const int constMaxFetches=4;
+static const int constMaxFetchAttempts=4;
+static const int constFetchTimeout=5*1000;
+static const int constFetchRetryDelay=1000; // Doubled for each subsequent attempt
+static const int constFetchFailedDelay=60*1000; // Ignore announcements for this long after all attempts fail
 
 static Core::MonoIcon::Type fontawesomeIcon(const QByteArray &name) {
     if (name=="chrome") {
@@ -101,19 +123,113 @@ static Core::MonoIcon::Type deviceIcon(const QByteArray &model) {
     return Core::MonoIcon::no_icon;
 }
 
+static bool isUsable(const QNetworkInterface &iface) {
+    QNetworkInterface::InterfaceFlags flags=iface.flags();
+    return (flags&QNetworkInterface::IsUp) && (flags&QNetworkInterface::IsRunning) &&
+           (flags&QNetworkInterface::CanMulticast) && !(flags&QNetworkInterface::IsLoopBack);
+}
+
+static bool hasProtocol(const QNetworkInterface &iface, QAbstractSocket::NetworkLayerProtocol protocol) {
+    foreach (const QNetworkAddressEntry &entry, iface.addressEntries()) {
+        if (protocol==entry.ip().protocol()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static QList<QHostAddress> addresses(const QNetworkInterface &iface) {
+    QList<QHostAddress> addr;
+    foreach (const QNetworkAddressEntry &entry, iface.addressEntries()) {
+        addr.append(entry.ip());
+    }
+    return addr;
+}
+
+static bool isLinkLocal(const QHostAddress &addr) {
+    if (QAbstractSocket::IPv6Protocol!=addr.protocol()) {
+        return false;
+    }
+    Q_IPV6ADDR ip=addr.toIPv6Address();
+    return 0xfe==ip[0] && 0x80==(ip[1]&0xc0);
+}
+
+/*
+ * IPv6 link-local LOCATION URLs do not contain the zone, so we need to add the one the
+ * announcement was received on - otherwise we cannot connect.
+ */
+static QUrl locationUrl(const QByteArray &location, const QHostAddress &sender) {
+    QUrl url(QString::fromLatin1(location));
+    if (isLinkLocal(sender) && !sender.scopeId().isEmpty() && !url.host().contains('%') &&
+        QHostAddress(url.host())==QHostAddress(sender.toString().section('%', 0, 0))) {
+        url.setHost(url.host()+'%'+sender.scopeId());
+    }
+    return url;
+}
+
+static QString cacheFileName(bool createDir) {
+    QString dir=Core::Utils::cacheDir(constCacheDir, createDir);
+    return dir.isEmpty() ? QString() : (dir+constCacheFile);
+}
+
 Upnp::Ssdp::Ssdp(QObject *p)
     : QObject(p)
     , network(0)
-    , socket(0)
+    , socket4(0)
+    , socket6(0)
+    , fetchTimer(0)
+    , targetedSearch(false)
+    , ipv6(true)
+    , cacheModified(false)
+    , expiryPos(0)
+    , expiryTimer(0)
+    , refreshTimer(0)
+    , listTimer(0)
     , refreshTimeout(constBackgroundSearchPeriod)
 {
+    expiryWheel.resize(constExpirySlots);
+    expiryClock.start();
     QNetworkConfigurationManager *mgr=new QNetworkConfigurationManager(this);
     connect(mgr, SIGNAL(onlineStateChanged(bool)), this, SLOT(onlineStateChanged(bool)));
     connect(mgr, SIGNAL(onlineStateChanged(bool)), this, SIGNAL(connectionStateChanged(bool)));
+    connect(mgr, SIGNAL(configurationAdded(QNetworkConfiguration)), this, SLOT(interfacesChanged()));
+    connect(mgr, SIGNAL(configurationRemoved(QNetworkConfiguration)), this, SLOT(interfacesChanged()));
+    connect(mgr, SIGNAL(configurationChanged(QNetworkConfiguration)), this, SLOT(interfacesChanged()));
+    ipv6=Core::Configuration(this).get("ipv6", true);
+
+    // Devices that should be contacted directly, either the URL of their description or just their host
+    foreach (const QString &entry, Core::Configuration(this).get("staticDevices", QStringList())) {
+        QString str=entry.trimmed();
+        if (str.contains("://")) {
+            QUrl url(str);
+            if (url.isValid()) {
+                staticUrls.append(url);
+            }
+        } else if (!str.isEmpty()) {
+            staticHosts.append(str);
+        }
+    }
+}
+
+Upnp::Ssdp::~Ssdp() {
+    // Cache changes are written out from expiryTick(), so flush any that are still pending
+    if (cacheModified) {
+        saveCache();
+    }
+}
+
+/*
+ * Set the service types that we are interested in. Devices that do not provide any of these
+ * are not reported. If targeted is set, then we only search for (and listen to announcements
+ * of) these service types - rather than all root devices.
+ */
+void Upnp::Ssdp::setServiceTypes(const QList<QByteArray> &types, bool targeted) {
+    serviceTypes=types;
+    targetedSearch=targeted && !types.isEmpty();
 }
 
 void Upnp::Ssdp::start() {
-    if (socket) {
+    if (socket4 || socket6) {
         return;
     }
 
@@ -127,30 +243,134 @@ void Upnp::Ssdp::start() {
     refreshTimer->setSingleShot(true);
     refreshTimer->start(constBackgroundSearchPeriod);
 
+    // Only used to prevent searches being sent too frequently
     listTimer=new QTimer(this);
     listTimer->setSingleShot(true);
-    connect(listTimer, SIGNAL(timeout()), SLOT(listingTimeout()));
+
+    expiryTimer=new QTimer(this);
+    connect(expiryTimer, SIGNAL(timeout()), SLOT(expiryTick()));
+    expiryTimer->start(constExpiryTick);
+
+    // Emit devices found in a previous session straight away, these will be re-validated
+    // when (if) they respond to our search - and removed if they do not.
+    loadCache();
+    QMap<QByteArray, CachedDevice>::ConstIterator it=cache.constBegin();
+    QMap<QByteArray, CachedDevice>::ConstIterator end=cache.constEnd();
+    for (; it!=end; ++it) {
+        knownDevices.insert(it.key());
+        unvalidated.insert(it.key());
+        scheduleExpiry(it.key(), constUrgentSearchPeriod);
+        DBUG(Ssdp) << "deviceAdded (cache)" << it.key() << it.value().device.type;
+        emit deviceAdded(it.value().device);
+    }
 
     search();
 }
 
 void Upnp::Ssdp::search() {
-    if (listTimer->isActive()) {
+    if (!listTimer || listTimer->isActive()) {
         return;
     }
 
-    // Discover all UPnP devices
-    QByteArray request=QByteArray("M-SEARCH * HTTP/1.1" LINE_SEP "HOST: ")+QByteArray(constMulticastGroup)+
-                       QByteArray(":")+QByteArray::number(constPort)+
-                       QByteArray(LINE_SEP "MAN: \"ssdp:discover\"" LINE_SEP "MX: 3" LINE_SEP "ST: upnp:rootdevice" LINE_SEP LINE_SEP);
+    // Discover either all UPnP devices, or only those with the services we want
+    QList<QByteArray> types=targetedSearch ? serviceTypes : (QList<QByteArray>() << constRootDevice);
     int timeout=refreshTimeout>10000 ? 10000 : (refreshTimeout-750);
 
-    DBUG(Ssdp) << request << timeout;
-    socket->writeDatagram(request, QHostAddress(constMulticastGroup), constPort);
+    DBUG(Ssdp) << types << timeout << interfaces.keys();
+    searchStatic(types);
+    if (interfaces.isEmpty()) {
+        // Could not enumerate interfaces, so just use the default
+        search(socket4, QNetworkInterface(), types);
+    } else {
+        foreach (const QNetworkInterface &iface, interfaces) {
+            search(socket4, iface, types);
+            search(socket6, iface, types);
+        }
+    }
     listTimer->start(timeout);
     refreshTimer->start(refreshTimeout);
 }
 
+void Upnp::Ssdp::search(QUdpSocket *sock, const QNetworkInterface &iface, const QList<QByteArray> &types) {
+    if (!sock) {
+        return;
+    }
+
+    bool v6=sock==socket6;
+    if (iface.isValid()) {
+        if (!hasProtocol(iface, v6 ? QAbstractSocket::IPv6Protocol : QAbstractSocket::IPv4Protocol)) {
+            return;
+        }
+        sock->setMulticastInterface(iface);
+    }
+
+    QHostAddress group(v6 ? constMulticastGroup6 : constMulticastGroup);
+    QByteArray host=v6 ? (QByteArray("[")+constMulticastGroup6+"]") : QByteArray(constMulticastGroup);
+    foreach (const QByteArray &type, types) {
+        QByteArray request=QByteArray("M-SEARCH * HTTP/1.1" LINE_SEP "HOST: ")+host+
+                           QByteArray(":")+QByteArray::number(constPort)+
+                           QByteArray(LINE_SEP "MAN: \"ssdp:discover\"" LINE_SEP "MX: 3" LINE_SEP "ST: ")+type+
+                           QByteArray(LINE_SEP LINE_SEP);
+        sock->writeDatagram(request, group, constPort);
+    }
+}
+
+/*
+ * Statically configured devices are contacted directly - either by reading their description
+ * (if a URL was given), or by sending a unicast M-SEARCH to the host. This is done alongside
+ * the multicast search, so that these are found quickly even if multicast is unreliable.
+ */
+void Upnp::Ssdp::searchStatic(const QList<QByteArray> &types) {
+    foreach (const QUrl &url, staticUrls) {
+        QByteArray uuid=staticResolved.value(url.toString());
+        if (!uuid.isEmpty() && (knownDevices.contains(uuid) || irrelevant.contains(uuid))) {
+            continue;
+        }
+        Fetch fetch;
+        fetch.url=url;
+        fetch.location=url.toString().toLatin1();
+        fetch.localAddress=localAddress(QHostAddress(url.host()));
+        queueFetch(constStaticPrefix+fetch.location, fetch);
+    }
+
+    if (!socket4 || staticHosts.isEmpty()) {
+        return;
+    }
+    foreach (const QString &host, staticHosts) {
+        QHostAddress addr(host);
+        if (addr.isNull()) {
+            QHostInfo::lookupHost(host, this, SLOT(hostLookedUp(QHostInfo)));
+            continue;
+        }
+        QUdpSocket *sock=QAbstractSocket::IPv6Protocol==addr.protocol() ? socket6 : socket4;
+        if (!sock) {
+            continue;
+        }
+        staticAddresses.insert(addr);
+        foreach (const QByteArray &type, types) {
+            QByteArray request=QByteArray("M-SEARCH * HTTP/1.1" LINE_SEP "HOST: ")+addr.toString().toLatin1()+
+                               QByteArray(":")+QByteArray::number(constPort)+
+                               QByteArray(LINE_SEP "MAN: \"ssdp:discover\"" LINE_SEP "ST: ")+type+
+                               QByteArray(LINE_SEP LINE_SEP);
+            sock->writeDatagram(request, addr, constPort);
+        }
+    }
+}
+
+void Upnp::Ssdp::hostLookedUp(const QHostInfo &info) {
+    if (QHostInfo::NoError!=info.error() || info.addresses().isEmpty()) {
+        DBUG(Ssdp) << "Failed to lookup" << info.hostName() << info.errorString();
+        return;
+    }
+
+    // Replace name with address, so that we do not need to lookup again
+    int idx=staticHosts.indexOf(info.hostName());
+    if (-1!=idx) {
+        staticHosts[idx]=info.addresses().first().toString();
+        searchStatic(targetedSearch ? serviceTypes : (QList<QByteArray>() << constRootDevice));
+    }
+}
+
 /*
  * When servers, or renderers, list is displayed (or requested) we need
  * to search more often - so that new devices are discovered quickly.
@@ -175,57 +395,109 @@ void Upnp::Ssdp::urgentSearch(bool s, int t) {
 
 void Upnp::Ssdp::readDatagrams() {
 //    DBUG(Ssdp);
+    QUdpSocket *socket=qobject_cast<QUdpSocket *>(QObject::sender());
+    if (!socket) {
+        return;
+    }
 
     while (socket->hasPendingDatagrams()) {
-        QByteArray datagram;
-        datagram.resize(socket->pendingDatagramSize());
+        qint64 pending=socket->pendingDatagramSize();
+        if (pending>datagram.size()) {
+            datagram.resize(pending);
+        }
         QHostAddress sender;
         quint16 senderPort;
 
-        socket->readDatagram(datagram.data(), datagram.size(), &sender, &senderPort);
-        bool isSearchResponse=datagram.startsWith("HTTP/1.1 200 OK");
-        bool isNotify=datagram.startsWith("NOTIFY * HTTP/1.1");
-
-        if (isSearchResponse || isNotify) {
-            QList<QByteArray> parts=datagram.replace("\r", "").split('\n');
-            QByteArray location;
-            QByteArray uuid;
-            bool isAlive=false;
-            bool isByeBye=false;
-            foreach (const QByteArray &part, parts) {
-                QByteArray upper=part.toUpper();
-                if (upper.startsWith("LOCATION: ")) {
-                    location=part.mid(10);
-                } else if (upper.startsWith("USN: ")) {
-                    uuid=part.mid(5);
-                } else if (isNotify && upper.startsWith("NTS: ")) {
-                    if (upper.endsWith("SSDP:BYEBYE")) {
-                        isByeBye=true;
-                    } else if (upper.endsWith("SSDP:ALIVE")) {
-                        isAlive=true;
-                    }
-                }
+        qint64 size=socket->readDatagram(datagram.data(), datagram.size(), &sender, &senderPort);
+        if (size<=0) {
+            continue;
+        }
+        SsdpMessage msg;
+        if (msg.parse(datagram.constData(), size)) {
+            bool isSearchResponse=SsdpMessage::Type_SearchResponse==msg.type;
+            bool isAlive=SsdpMessage::Nts_Alive==msg.nts;
+            bool isByeBye=SsdpMessage::Nts_ByeBye==msg.nts;
+            const QByteArray &location=msg.location;
+            const QByteArray &bootId=msg.bootId;
+            const QByteArray &configId=msg.configId;
+            const QByteArray &type=msg.target;
+            QByteArray uuid=msg.usn;
+            int age=msg.age;
+
+            // USN is of the form uuid:<uuid>::<type>
+            if (!uuid.startsWith("uuid:")) {
+                continue;
+            }
+            int sep=uuid.indexOf("::");
+            uuid=uuid.mid(5, -1==sep ? -1 : sep-5);
+            if (uuid.isEmpty()) {
+                continue;
             }
 
-            if (!uuid.isEmpty() && uuid.endsWith("::upnp:rootdevice")) {
-                uuid=uuid.left(uuid.length()-17).mid(5);
-                if (isSearchResponse) {
-                    listedDevices.insert(uuid);
-                }
-                if ((isSearchResponse || isAlive) && !location.isEmpty() && !knownDevices.contains(uuid)) {
-                    if (!network) {
-                        network=new Core::NetworkAccessManager(this);
+            bool wanted=targetedSearch ? serviceTypes.contains(type) : constRootDevice==type;
+            if (wanted || isByeBye) {
+                if ((isSearchResponse || isAlive) && !location.isEmpty()) {
+                    QHash<QByteArray, QByteArray>::ConstIterator irr=irrelevant.constFind(uuid);
+                    if (irrelevant.constEnd()!=irr) {
+                        if (irr.value()==location) {
+                            continue;
+                        }
+                        // Device has moved, so its description might have changed - re-read
+                        irrelevant.remove(uuid);
                     }
-                    Core::NetworkJob *job=network->get(QUrl(location));
-                    if (job) {
-                        jobs.append(job);
-                        job->setProperty(constUuidProp, uuid);
-                        connect(job, SIGNAL(finished()), SLOT(jobFinished()));
+                    if (staticAddresses.contains(sender)) {
+                        staticDevices.insert(uuid);
+                    }
+                    // Device is valid until its advertisement expires, unless re-announced
+                    scheduleExpiry(uuid, ((qint64)age*1000)+constExpiryGrace);
+                    bool cached=isCacheValid(uuid, location, bootId, configId);
+                    if (unvalidated.contains(uuid)) {
+                        unvalidated.remove(uuid);
+                        if (!cached) {
+                            // Description has changed since it was cached, so remove and re-read
+                            knownDevices.remove(uuid);
+                            DBUG(Ssdp) << "deviceRemoved (stale cache)" << uuid;
+                            emit deviceRemoved(uuid);
+                        }
+                    }
+                    if (cached) {
+                        CachedDevice &entry=cache[uuid];
+                        if (entry.bootId!=bootId) {
+                            entry.bootId=bootId;
+                            cacheModified=true;
+                        }
+                        entry.lastSeen=QDateTime::currentDateTime();
+                    }
+                    QByteArray local=localAddress(sender);
+                    if (cached) {
+                        if (!knownDevices.contains(uuid) || cache[uuid].device.localAddress!=local) {
+                            // Re-emitting an already known device updates its local address
+                            Device &device=cache[uuid].device;
+                            device.localAddress=local;
+                            knownDevices.insert(uuid);
+                            DBUG(Ssdp) << "deviceAdded (cache)" << uuid << local;
+                            emit deviceAdded(device);
+                        }
+                    } else if (!knownDevices.contains(uuid)) {
+                        Fetch fetch;
+                        fetch.url=locationUrl(location, sender);
+                        fetch.location=location;
+                        fetch.bootId=bootId;
+                        fetch.configId=configId;
+                        fetch.localAddress=local;
+                        queueFetch(uuid, fetch);
                     }
-                    knownDevices.insert(uuid);
-                    DBUG(Ssdp) << "Read descr of" << uuid << location;
                 } else if (isByeBye) {
+                    cancelFetch(uuid);
+                    if (cache.remove(uuid)) {
+                        cacheModified=true;
+                    }
+                    if (!knownDevices.contains(uuid)) {
+                        continue;
+                    }
                     knownDevices.remove(uuid);
+                    unvalidated.remove(uuid);
+                    cancelExpiry(uuid);
                     DBUG(Ssdp) << "deviceRemoved (byebye)" << uuid;
                     emit deviceRemoved(uuid);
                 }
@@ -240,7 +512,11 @@ void Upnp::Ssdp::jobFinished() {
 
     if (job) {
         job->deleteLater();
-        if (0<=jobs.indexOf(job) && job->property(constUuidProp).isValid()) {
+        QByteArray uuid=job->property(constUuidProp).toByteArray();
+        QMap<QByteArray, Fetch>::Iterator fetch=fetches.find(uuid);
+        if (fetches.end()!=fetch && fetch.value().job==job) {
+            fetch.value().job=0;
+            busyHosts.remove(fetch.value().url.host());
             #ifdef DISPLAY_XML
             QByteArray data=job->readAll();
             DBUG(Ssdp) << data;
@@ -250,9 +526,15 @@ void Upnp::Ssdp::jobFinished() {
             #endif
             Device device;
 
-            device.baseUrl=job->url().scheme().toLatin1()+"://"+job->url().host().toLatin1()+":"+QByteArray::number(job->url().port(80))+"/";
+            QByteArray host=job->url().host().toLatin1();
+            if (host.contains(':')) {
+                host='['+host+']';
+            }
+            device.baseUrl=job->url().scheme().toLatin1()+"://"+host+":"+QByteArray::number(job->url().port(80))+"/";
             device.host=QUrl(device.baseUrl).host();
-            device.uuid=job->property(constUuidProp).toByteArray();
+            device.uuid=uuid;
+            device.localAddress=fetch.value().localAddress;
+            bool isStatic=uuid.startsWith(constStaticPrefix);
             device.icon=Core::MonoIcon::no_icon;
 
             reader.setNamespaceProcessing(false);
@@ -266,6 +548,12 @@ void Upnp::Ssdp::jobFinished() {
                             if (QXmlStreamReader::StartElement==reader.tokenType()) {
                                 if (QLatin1String("deviceType")==reader.name()) {
                                     device.type=reader.readElementText().toLatin1();
+                                } else if (QLatin1String("UDN")==reader.name()) {
+                                    QByteArray udn=reader.readElementText().trimmed().toLatin1();
+                                    if (isStatic && device.uuid==uuid && udn.startsWith("uuid:") && udn.length()>5) {
+                                        // Statically configured URL, so uuid is not known until description is read
+                                        device.uuid=udn.mid(5);
+                                    }
                                 } else if (QLatin1String("friendlyName")==reader.name()) {
                                     device.name=reader.readElementText();
                                     if (device.name.endsWith(" (OpenHome)")) {
@@ -321,44 +609,355 @@ void Upnp::Ssdp::jobFinished() {
             if (device.baseUrl.endsWith('/') ){
                 device.baseUrl=device.baseUrl.left(device.baseUrl.length()-1);
             }
-            DBUG(Ssdp) << "deviceAdded" << device.uuid << device.type << device.services.keys();
-            emit deviceAdded(device);
+            bool relevant=serviceTypes.isEmpty();
+            foreach (const QByteArray &type, serviceTypes) {
+                if (device.services.contains(type)) {
+                    relevant=true;
+                    break;
+                }
+            }
+            if (!job->ok() || reader.hasError() || device.type.isEmpty() || (isStatic && device.uuid==uuid)) {
+                fetchFailed(uuid, fetch.value(), job->ok() ? reader.errorString() : job->errorString());
+            } else if (!relevant) {
+                // Not a device we can use, so remember this to prevent fetching its description again
+                DBUG(Ssdp) << "Ignoring" << device.uuid << device.type << device.services.keys();
+                irrelevant.insert(device.uuid, fetch.value().location);
+                if (isStatic) {
+                    staticResolved.insert(fetch.value().location, device.uuid);
+                }
+                cancelExpiry(device.uuid);
+                fetches.erase(fetch);
+            } else {
+                DBUG(Ssdp) << "deviceAdded" << device.uuid << device.type << device.services.keys();
+                CachedDevice &entry=cache[device.uuid];
+                entry.device=device;
+                entry.location=fetch.value().location;
+                entry.bootId=fetch.value().bootId;
+                entry.configId=fetch.value().configId;
+                entry.lastSeen=QDateTime::currentDateTime();
+                cacheModified=true;
+                fetches.erase(fetch);
+                if (isStatic) {
+                    // Static devices do not expire, and are only removed via byebye
+                    staticResolved.insert(entry.location, device.uuid);
+                    staticDevices.insert(device.uuid);
+                    unvalidated.remove(device.uuid);
+                    cancelExpiry(device.uuid);
+                }
+                knownDevices.insert(device.uuid);
+                emit deviceAdded(device);
+            }
+            startFetches();
         }
         job->cancelAndDelete();
     }
 }
 
-void Upnp::Ssdp::listingTimeout() {
-    QSet<QByteArray> removedDevices=knownDevices-listedDevices;
-    DBUG(Ssdp) << "listed:" << listedDevices << "known:" << knownDevices << "removed:" << removedDevices;
+/*
+ * Description fetches are queued, so that at most constMaxFetches are active at any one
+ * time - and only one per host. Failed fetches are retried with an increasing delay, and
+ * if all attempts fail the device is ignored for a while.
+ */
+void Upnp::Ssdp::queueFetch(const QByteArray &uuid, const Fetch &fetch) {
+    QMap<QByteArray, Fetch>::Iterator it=fetches.find(uuid);
+    if (fetches.end()!=it) {
+        if (Fetch::Failed!=it.value().state || it.value().retryAt>expiryClock.elapsed()) {
+            return;
+        }
+        fetches.erase(it);
+    }
+
+    DBUG(Ssdp) << "Queue descr of" << uuid << fetch.url;
+    fetches.insert(uuid, fetch);
+    fetchQueue.append(uuid);
+    startFetches();
+}
+
+void Upnp::Ssdp::cancelFetch(const QByteArray &uuid) {
+    QMap<QByteArray, Fetch>::Iterator it=fetches.find(uuid);
+    if (fetches.end()!=it) {
+        if (it.value().job) {
+            busyHosts.remove(it.value().url.host());
+            disconnect(it.value().job, SIGNAL(finished()), this, SLOT(jobFinished()));
+            it.value().job->cancelAndDelete();
+        }
+        fetches.erase(it);
+        fetchQueue.removeAll(uuid);
+    }
+}
+
+void Upnp::Ssdp::cancelFetches() {
+    foreach (const QByteArray &uuid, fetches.keys()) {
+        cancelFetch(uuid);
+    }
+    if (fetchTimer) {
+        fetchTimer->stop();
+    }
+}
+
+void Upnp::Ssdp::startFetches() {
+    qint64 now=expiryClock.elapsed();
+    qint64 next=-1;
+
+    QList<QByteArray>::Iterator it=fetchQueue.begin();
+    while (it!=fetchQueue.end() && busyHosts.count()<constMaxFetches) {
+        QMap<QByteArray, Fetch>::Iterator fetch=fetches.find(*it);
+        if (fetches.end()==fetch || Fetch::Queued!=fetch.value().state) {
+            it=fetchQueue.erase(it);
+            continue;
+        }
+        Fetch &f=fetch.value();
+        if (f.retryAt>now) {
+            next=-1==next ? f.retryAt : qMin(next, f.retryAt);
+            ++it;
+            continue;
+        }
+        if (busyHosts.contains(f.url.host())) {
+            ++it;
+            continue;
+        }
+
+        if (!network) {
+            network=new Core::NetworkAccessManager(this);
+        }
+        f.job=network->get(f.url, constFetchTimeout);
+        if (!f.job) {
+            ++it;
+            continue;
+        }
+        f.state=Fetch::Running;
+        f.attempts++;
+        f.job->setProperty(constUuidProp, *it);
+        connect(f.job, SIGNAL(finished()), SLOT(jobFinished()));
+        busyHosts.insert(f.url.host());
+        DBUG(Ssdp) << "Read descr of" << *it << f.url << "attempt" << f.attempts;
+        it=fetchQueue.erase(it);
+    }
+
+    // Check for any remaining entries that are waiting for a retry
+    for (; it!=fetchQueue.end(); ++it) {
+        QMap<QByteArray, Fetch>::ConstIterator fetch=fetches.constFind(*it);
+        if (fetches.constEnd()!=fetch && fetch.value().retryAt>now) {
+            next=-1==next ? fetch.value().retryAt : qMin(next, fetch.value().retryAt);
+        }
+    }
+
+    if (-1!=next) {
+        if (!fetchTimer) {
+            fetchTimer=new QTimer(this);
+            fetchTimer->setSingleShot(true);
+            connect(fetchTimer, SIGNAL(timeout()), SLOT(startFetches()));
+        }
+        fetchTimer->start(qMax((qint64)0, next-now));
+    }
+}
+
+void Upnp::Ssdp::fetchFailed(const QByteArray &uuid, Fetch &fetch, const QString &reason) {
+    qint64 now=expiryClock.elapsed();
+
+    if (fetch.attempts<constMaxFetchAttempts) {
+        fetch.state=Fetch::Queued;
+        fetch.retryAt=now+(constFetchRetryDelay<<(fetch.attempts-1));
+        fetchQueue.append(uuid);
+        DBUG(Ssdp) << "Failed to read descr of" << uuid << reason << "retry in" << (fetch.retryAt-now);
+    } else {
+        fetch.state=Fetch::Failed;
+        fetch.retryAt=now+constFetchFailedDelay;
+        DBUG(Ssdp) << "Failed to read descr of" << uuid << reason << "giving up";
+    }
+}
+
+/*
+ * Devices are expired using a timer wheel - each slot holds the devices due to expire
+ * within that tick. Advertisements can be valid for longer than the wheel spans, so
+ * entries whose deadline has not yet been reached are simply moved along.
+ */
+void Upnp::Ssdp::expiryTick() {
+    expiryPos=(expiryPos+1)%constExpirySlots;
+    QSet<QByteArray> due=expiryWheel[expiryPos];
+    expiryWheel[expiryPos].clear();
+
+    qint64 now=expiryClock.elapsed();
+    foreach (const QByteArray &uuid, due) {
+        QHash<QByteArray, Expiry>::Iterator it=expiries.find(uuid);
+        if (expiries.end()==it) {
+            continue;
+        }
+        if (it.value().deadline>now) {
+            scheduleExpiry(uuid, it.value().deadline-now);
+            continue;
+        }
+        expiries.erase(it);
+        if (cache.remove(uuid)) {
+            cacheModified=true;
+        }
+        if (knownDevices.contains(uuid)) {
+            knownDevices.remove(uuid);
+            unvalidated.remove(uuid);
+            DBUG(Ssdp) << "deviceRemoved (expired)" << uuid;
+            emit deviceRemoved(uuid);
+        }
+    }
+
+    if (cacheModified) {
+        saveCache();
+    }
+}
+
+void Upnp::Ssdp::scheduleExpiry(const QByteArray &uuid, qint64 msecs) {
+    if (staticDevices.contains(uuid)) {
+        return;
+    }
+    qint64 ticks=(msecs+constExpiryTick-1)/constExpiryTick;
+    int slot=(expiryPos+(int)qBound((qint64)1, ticks, (qint64)(constExpirySlots-1)))%constExpirySlots;
+    QHash<QByteArray, Expiry>::Iterator it=expiries.find(uuid);
+
+    if (expiries.end()!=it) {
+        if (it.value().slot!=slot) {
+            expiryWheel[it.value().slot].remove(uuid);
+        }
+        it.value()=Expiry(expiryClock.elapsed()+msecs, slot);
+    } else {
+        expiries.insert(uuid, Expiry(expiryClock.elapsed()+msecs, slot));
+    }
+    expiryWheel[slot].insert(uuid);
+}
 
-    foreach (const QByteArray &uuid, removedDevices) {
-        knownDevices.remove(uuid);
-        DBUG(Ssdp) << "deviceRemoved" << uuid;
-        emit deviceRemoved(uuid);
+void Upnp::Ssdp::cancelExpiry(const QByteArray &uuid) {
+    QHash<QByteArray, Expiry>::Iterator it=expiries.find(uuid);
+    if (expiries.end()!=it) {
+        expiryWheel[it.value().slot].remove(uuid);
+        expiries.erase(it);
     }
-    listedDevices.clear();
 }
 
 void Upnp::Ssdp::connectSocket() {
-    if (socket) {
-        disconnect(socket, SIGNAL(readyRead()), this, SLOT(readDatagrams()));
-        socket->close();
-        socket->deleteLater();
+    foreach (QUdpSocket *sock, QList<QUdpSocket *>() << socket4 << socket6) {
+        if (sock) {
+            disconnect(sock, SIGNAL(readyRead()), this, SLOT(readDatagrams()));
+            sock->close();
+            sock->deleteLater();
+        }
     }
-    socket=new QUdpSocket(this);
+    interfaces.clear();
+    socket4=createSocket(false);
+    socket6=ipv6 ? createSocket(true) : 0;
+    updateInterfaces();
+}
+
+QUdpSocket * Upnp::Ssdp::createSocket(bool v6) {
+    QUdpSocket *sock=new QUdpSocket(this);
+    QHostAddress any(v6 ? QHostAddress::AnyIPv6 : QHostAddress::AnyIPv4);
+    bool ok=false;
 
     #ifdef Q_OS_LINUX
     // Workaround for https://bugreports.qt.io/browse/QTBUG-33419
-    socket->setSocketDescriptor(::socket(PF_INET, SOCK_DGRAM, 0), QAbstractSocket::UnconnectedState);
+    sock->setSocketDescriptor(::socket(v6 ? PF_INET6 : PF_INET, SOCK_DGRAM, 0), QAbstractSocket::UnconnectedState);
     int reuse=1;
-    ::setsockopt(socket->socketDescriptor(), SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-    socket->bind(QHostAddress(QHostAddress::AnyIPv4), constPort, QUdpSocket::DefaultForPlatform);
+    ::setsockopt(sock->socketDescriptor(), SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (v6) {
+        int only=1;
+        ::setsockopt(sock->socketDescriptor(), IPPROTO_IPV6, IPV6_V6ONLY, &only, sizeof(only));
+    }
+    ok=sock->bind(any, constPort, QUdpSocket::DefaultForPlatform);
     #else
-    socket->bind(QHostAddress(QHostAddress::AnyIPv4), constPort, QUdpSocket::ReuseAddressHint|QUdpSocket::ShareAddress);
+    ok=sock->bind(any, constPort, QUdpSocket::ReuseAddressHint|QUdpSocket::ShareAddress);
     #endif
-    socket->joinMulticastGroup(QHostAddress(constMulticastGroup));
-    connect(socket, SIGNAL(readyRead()), this, SLOT(readDatagrams()));
+    if (!ok) {
+        DBUG(Ssdp) << "Failed to bind" << any << sock->errorString();
+        // IPv6 is optional, but always keep the IPv4 socket - as was done previously
+        if (v6) {
+            sock->deleteLater();
+            return 0;
+        }
+    }
+    connect(sock, SIGNAL(readyRead()), this, SLOT(readDatagrams()));
+    return sock;
+}
+
+/*
+ * Join multicast group(s) on any new interfaces, and leave those on removed interfaces.
+ * Returns true if any have been added (or changed), in which case a search should be made.
+ */
+bool Upnp::Ssdp::updateInterfaces() {
+    QMap<QString, QNetworkInterface> current;
+    foreach (const QNetworkInterface &iface, QNetworkInterface::allInterfaces()) {
+        if (isUsable(iface)) {
+            current.insert(iface.name(), iface);
+        }
+    }
+
+    bool added=false;
+    QMap<QString, QNetworkInterface>::ConstIterator it=interfaces.constBegin();
+    QMap<QString, QNetworkInterface>::ConstIterator end=interfaces.constEnd();
+    for (; it!=end; ++it) {
+        QMap<QString, QNetworkInterface>::ConstIterator cur=current.constFind(it.key());
+        if (current.constEnd()==cur || addresses(cur.value())!=addresses(it.value())) {
+            DBUG(Ssdp) << "Leave" << it.key();
+            if (socket4 && hasProtocol(it.value(), QAbstractSocket::IPv4Protocol)) {
+                socket4->leaveMulticastGroup(QHostAddress(constMulticastGroup), it.value());
+            }
+            if (socket6 && hasProtocol(it.value(), QAbstractSocket::IPv6Protocol)) {
+                socket6->leaveMulticastGroup(QHostAddress(constMulticastGroup6), it.value());
+            }
+        }
+    }
+
+    it=current.constBegin();
+    end=current.constEnd();
+    for (; it!=end; ++it) {
+        QMap<QString, QNetworkInterface>::ConstIterator prev=interfaces.constFind(it.key());
+        if (interfaces.constEnd()==prev || addresses(prev.value())!=addresses(it.value())) {
+            DBUG(Ssdp) << "Join" << it.key();
+            if (socket4 && hasProtocol(it.value(), QAbstractSocket::IPv4Protocol)) {
+                socket4->joinMulticastGroup(QHostAddress(constMulticastGroup), it.value());
+            }
+            if (socket6 && hasProtocol(it.value(), QAbstractSocket::IPv6Protocol)) {
+                socket6->joinMulticastGroup(QHostAddress(constMulticastGroup6), it.value());
+            }
+            added=true;
+        }
+    }
+
+    if (current.isEmpty() && interfaces.isEmpty() && socket4) {
+        // Could not enumerate interfaces, so just use the default
+        socket4->joinMulticastGroup(QHostAddress(constMulticastGroup));
+    }
+    interfaces=current;
+    return added;
+}
+
+void Upnp::Ssdp::interfacesChanged() {
+    if ((socket4 || socket6) && updateInterfaces()) {
+        if (listTimer) {
+            listTimer->stop();
+        }
+        search();
+    }
+}
+
+/*
+ * Determine the address of the local interface on which a device can be reached. This is
+ * then used as the address in event subscription callbacks.
+ */
+QByteArray Upnp::Ssdp::localAddress(const QHostAddress &addr) const {
+    QString scope=addr.scopeId();
+    foreach (const QNetworkInterface &iface, interfaces) {
+        foreach (const QNetworkAddressEntry &entry, iface.addressEntries()) {
+            QHostAddress ip=entry.ip();
+            if (ip.protocol()!=addr.protocol()) {
+                continue;
+            }
+            bool match=isLinkLocal(addr)
+                        ? isLinkLocal(ip) && (scope==iface.name() || scope==QString::number(iface.index()))
+                        : entry.prefixLength()>0 && addr.isInSubnet(ip, entry.prefixLength());
+            if (match) {
+                ip.setScopeId(QString());
+                return ip.toString().toLatin1();
+            }
+        }
+    }
+    return QByteArray();
 }
 
 void Upnp::Ssdp::onlineStateChanged(bool on) {
@@ -366,12 +965,26 @@ void Upnp::Ssdp::onlineStateChanged(bool on) {
     if (listTimer) {
         listTimer->stop();
     }
+    // Drop fetches started on the previous connection, before search() queues any new ones
+    cancelFetches();
     if (on) {
         if (refreshTimer) {
             refreshTimer->start();
         }
+        if (expiryTimer) {
+            expiryTimer->start();
+        }
+        // Devices remain known whilst offline, so allow them time to respond before expiring
+        qint64 now=expiryClock.elapsed();
+        foreach (const QByteArray &uuid, expiries.keys()) {
+            if (expiries[uuid].deadline<now+constUrgentSearchPeriod) {
+                scheduleExpiry(uuid, constUrgentSearchPeriod);
+            }
+        }
         connectSocket();
-        search();
+        if (listTimer) {
+            search();
+        }
     } else {
 //        foreach (const QByteArray &uuid, knownDevices) {
 //            DBUG(Ssdp) << "deviceRemoved" << uuid;
@@ -380,7 +993,90 @@ void Upnp::Ssdp::onlineStateChanged(bool on) {
         if (refreshTimer) {
             refreshTimer->stop();
         }
+        if (expiryTimer) {
+            expiryTimer->stop();
+        }
+    }
+}
+
+/*
+ * A cached description is only re-used if the device is at the same location, and
+ * its CONFIGID.UPNP.ORG is unchanged. UPnP 1.0 devices do not send CONFIGID, so for
+ * these we fallback to BOOTID.UPNP.ORG (which, again, 1.0 devices do not send - in
+ * which case only the location is checked).
+ */
+bool Upnp::Ssdp::isCacheValid(const QByteArray &uuid, const QByteArray &location, const QByteArray &bootId, const QByteArray &configId) const {
+    QMap<QByteArray, CachedDevice>::ConstIterator it=cache.find(uuid);
+    if (cache.constEnd()==it || it.value().location!=location) {
+        return false;
+    }
+    return configId.isEmpty() && it.value().configId.isEmpty()
+            ? it.value().bootId==bootId
+            : it.value().configId==configId;
+}
+
+void Upnp::Ssdp::loadCache() {
+    QFile file(cacheFileName(false));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    QDataStream stream(&file);
+    quint32 version=0;
+    quint32 count=0;
+    stream >> version;
+    if (constCacheVersion!=version) {
+        DBUG(Ssdp) << "Ignoring cache, version" << version;
+        return;
+    }
+    stream >> count;
+
+    QDateTime oldest=QDateTime::currentDateTime().addDays(-constCacheMaxAge);
+    for (quint32 i=0; i<count && QDataStream::Ok==stream.status(); ++i) {
+        CachedDevice entry;
+        quint32 icon=0;
+        quint32 numServices=0;
+        stream >> entry.location >> entry.bootId >> entry.configId >> entry.lastSeen
+               >> entry.device.type >> entry.device.uuid >> entry.device.manufacturer >> entry.device.name
+               >> entry.device.baseUrl >> entry.device.host >> icon >> numServices;
+        entry.device.icon=(Core::MonoIcon::Type)icon;
+        for (quint32 s=0; s<numServices && QDataStream::Ok==stream.status(); ++s) {
+            QByteArray type;
+            Device::Service service;
+            stream >> type >> service.id >> service.controlUrl >> service.eventUrl;
+            entry.device.services.insert(type, service);
+        }
+        if (QDataStream::Ok==stream.status() && !entry.device.uuid.isEmpty() && entry.lastSeen>=oldest) {
+            cache.insert(entry.device.uuid, entry);
+        } else {
+            cacheModified=true;
+        }
+    }
+    DBUG(Ssdp) << "Loaded" << cache.count() << "cached devices";
+}
+
+void Upnp::Ssdp::saveCache() {
+    cacheModified=false;
+    QFile file(cacheFileName(true));
+    if (!file.open(QIODevice::WriteOnly)) {
+        DBUG(Ssdp) << "Failed to write cache" << file.fileName();
+        return;
+    }
+
+    QDataStream stream(&file);
+    stream << constCacheVersion << (quint32)cache.count();
+    QMap<QByteArray, CachedDevice>::ConstIterator it=cache.constBegin();
+    QMap<QByteArray, CachedDevice>::ConstIterator end=cache.constEnd();
+    for (; it!=end; ++it) {
+        const CachedDevice &entry=it.value();
+        stream << entry.location << entry.bootId << entry.configId << entry.lastSeen
+               << entry.device.type << entry.device.uuid << entry.device.manufacturer << entry.device.name
+               << entry.device.baseUrl << entry.device.host << (quint32)entry.device.icon
+               << (quint32)entry.device.services.count();
+        Device::Services::ConstIterator sit=entry.device.services.constBegin();
+        Device::Services::ConstIterator send=entry.device.services.constEnd();
+        for (; sit!=send; ++sit) {
+            stream << sit.key() << sit.value().id << sit.value().controlUrl << sit.value().eventUrl;
+        }
     }
-    knownDevices.clear();
-    listedDevices.clear();
 }
@@ -29,9 +29,18 @@
 #include <QList>
 #include <QMap>
 #include <QSet>
+#include <QHash>
+#include <QVector>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QNetworkInterface>
+#include <QUrl>
+#include <QHostAddress>
+#include <QStringList>
 
 class QUdpSocket;
 class QTimer;
+class QHostInfo;
 namespace Core {
 class NetworkAccessManager;
 class NetworkJob;
@@ -59,11 +68,14 @@ public:
         QString host;
         Services services;
         Core::MonoIcon::Type icon;
+        QByteArray localAddress; // Address of the interface the device was found on (not cached)
     };
 
 public:
     Ssdp(QObject *p);
+    ~Ssdp();
     void setNetwork(Core::NetworkAccessManager *net) { if (!network) network=net; }
+    void setServiceTypes(const QList<QByteArray> &types, bool targeted);
 
 Q_SIGNALS:
     void deviceAdded(const Ssdp::Device &details);
@@ -78,18 +90,93 @@ public Q_SLOTS:
 private Q_SLOTS:
     void readDatagrams();
     void jobFinished();
-    void listingTimeout();
+    void expiryTick();
+    void interfacesChanged();
+    void startFetches();
+    void hostLookedUp(const QHostInfo &info);
     void onlineStateChanged(bool on);
 
 private:
+    // Parsed device description, as stored in the on-disk cache
+    struct CachedDevice {
+        Device device;
+        QByteArray location;
+        QByteArray bootId;
+        QByteArray configId;
+        QDateTime lastSeen;
+    };
+
+    // Position of a device within the expiry timer wheel
+    struct Expiry {
+        Expiry(qint64 d=0, int s=0) : deadline(d), slot(s) { }
+        qint64 deadline;
+        int slot;
+    };
+
+    // State of a device description download
+    struct Fetch {
+        enum State {
+            Queued,
+            Running,
+            Failed
+        };
+
+        Fetch() : state(Queued), attempts(0), retryAt(0), job(0) { }
+        QUrl url;
+        QByteArray location;
+        QByteArray bootId;
+        QByteArray configId;
+        QByteArray localAddress;
+        State state;
+        int attempts;
+        qint64 retryAt;
+        Core::NetworkJob *job;
+    };
+
+    void queueFetch(const QByteArray &uuid, const Fetch &fetch);
+    void cancelFetch(const QByteArray &uuid);
+    void cancelFetches();
+    void fetchFailed(const QByteArray &uuid, Fetch &fetch, const QString &reason);
     void connectSocket();
+    QUdpSocket * createSocket(bool v6);
+    bool updateInterfaces();
+    QByteArray localAddress(const QHostAddress &addr) const;
+    void search(QUdpSocket *sock, const QNetworkInterface &iface, const QList<QByteArray> &types);
+    void searchStatic(const QList<QByteArray> &types);
+    bool isCacheValid(const QByteArray &uuid, const QByteArray &location, const QByteArray &bootId, const QByteArray &configId) const;
+    void loadCache();
+    void saveCache();
+    void scheduleExpiry(const QByteArray &uuid, qint64 msecs);
+    void cancelExpiry(const QByteArray &uuid);
 
 private:
     Core::NetworkAccessManager *network;
-    QUdpSocket *socket;
-    QList<Core::NetworkJob *> jobs;
+    QUdpSocket *socket4;
+    QUdpSocket *socket6;
+    QMap<QString, QNetworkInterface> interfaces; // Interfaces on which multicast group(s) have been joined
+    QByteArray datagram; // Receive buffer, re-used for each datagram
+    QMap<QByteArray, Fetch> fetches;
+    QList<QByteArray> fetchQueue;
+    QSet<QString> busyHosts; // Hosts with an active description fetch
+    QTimer *fetchTimer;
     QSet<QByteArray> knownDevices;
-    QSet<QByteArray> listedDevices;
+    QMap<QByteArray, CachedDevice> cache;
+    QSet<QByteArray> unvalidated; // Emitted from cache, but not yet seen on the network
+    QHash<QByteArray, QByteArray> irrelevant; // uuid -> location of devices without any wanted service
+    QList<QUrl> staticUrls;
+    QStringList staticHosts;
+    QSet<QHostAddress> staticAddresses;
+    QHash<QString, QByteArray> staticResolved; // Static URL -> uuid
+    QSet<QByteArray> staticDevices; // uuids of static devices, these are not expired
+    QList<QByteArray> serviceTypes;
+    bool targetedSearch;
+    bool ipv6;
+    bool cacheModified;
+    QHash<QByteArray, Expiry> expiries;
+    QVector<QSet<QByteArray> > expiryWheel;
+    int expiryPos;
+    QElapsedTimer expiryClock;
+    QTimer *expiryTimer;
     QTimer *refreshTimer;
     QTimer *listTimer;
     int refreshTimeout;
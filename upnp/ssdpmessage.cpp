@@ -0,0 +1,154 @@
+/*
+ * Madrigal
+ *
+ * Copyright (c) 2016 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "upnp/ssdpmessage.h"
+#include <string.h>
+
+static const int constDefaultMaxAge=1800; // Seconds, used if CACHE-CONTROL is missing or invalid
+
+static bool equals(const char *str, int len, const char *other, int otherLen) {
+    return len==otherLen && 0==qstrnicmp(str, other, len);
+}
+
+#define EQUALS(STR, LEN, CONST_STR) equals(STR, LEN, CONST_STR, sizeof(CONST_STR)-1)
+
+/*
+ * Return the next header from the datagram, without copying. Leading and trailing
+ * whitespace (and the \r of \r\n) is removed from both key and value.
+ */
+static bool nextHeader(const char *&pos, const char *end, const char *&key, int &keyLen, const char *&value, int &valueLen) {
+    while (pos<end) {
+        const char *eol=(const char *)memchr(pos, '\n', end-pos);
+        const char *line=pos;
+        const char *lineEnd=eol ? eol : end;
+        pos=eol ? eol+1 : end;
+
+        const char *colon=(const char *)memchr(line, ':', lineEnd-line);
+        if (!colon) {
+            continue;
+        }
+        const char *v=colon+1;
+        while (line<colon && (' '==*line || '\t'==*line)) {
+            line++;
+        }
+        const char *k=colon;
+        while (k>line && (' '==k[-1] || '\t'==k[-1])) {
+            k--;
+        }
+        while (v<lineEnd && (' '==*v || '\t'==*v)) {
+            v++;
+        }
+        const char *ve=lineEnd;
+        while (ve>v && (' '==ve[-1] || '\t'==ve[-1] || '\r'==ve[-1])) {
+            ve--;
+        }
+        key=line;
+        keyLen=k-line;
+        value=v;
+        valueLen=ve-v;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Parse max-age from a CACHE-CONTROL value, e.g. "max-age=1800"
+ */
+static int maxAge(const char *value, int len) {
+    static const int constKeyLen=7;
+    for (int i=0; i+constKeyLen<=len; ++i) {
+        if (0==qstrnicmp(value+i, "max-age", constKeyLen)) {
+            i+=constKeyLen;
+            while (i<len && ' '==value[i]) {
+                i++;
+            }
+            if (i>=len || '='!=value[i]) {
+                break;
+            }
+            i++;
+            while (i<len && ' '==value[i]) {
+                i++;
+            }
+            int age=0;
+            int digits=0;
+            for (; i<len && value[i]>='0' && value[i]<='9' && digits<9; ++i, ++digits) {
+                age=(age*10)+(value[i]-'0');
+            }
+            return age>0 ? age : constDefaultMaxAge;
+        }
+    }
+    return constDefaultMaxAge;
+}
+
+bool Upnp::SsdpMessage::parse(const char *data, int size) {
+    const char *pos=data;
+    const char *end=data+size;
+
+    nts=Nts_Other;
+    age=constDefaultMaxAge;
+    location.clear();
+    usn.clear();
+    bootId.clear();
+    configId.clear();
+    target.clear();
+
+    if (size>=15 && 0==qstrncmp(pos, "HTTP/1.1 200 OK", 15)) {
+        type=Type_SearchResponse;
+    } else if (size>=17 && 0==qstrncmp(pos, "NOTIFY * HTTP/1.1", 17)) {
+        type=Type_Notify;
+    } else {
+        type=Type_Other;
+        return false;
+    }
+
+    const char *key;
+    const char *value;
+    int keyLen;
+    int valueLen;
+
+    // Skip start line
+    const char *eol=(const char *)memchr(pos, '\n', size);
+    pos=eol ? eol+1 : end;
+    while (nextHeader(pos, end, key, keyLen, value, valueLen)) {
+        if (EQUALS(key, keyLen, "LOCATION")) {
+            location=QByteArray(value, valueLen);
+        } else if (EQUALS(key, keyLen, "USN")) {
+            usn=QByteArray(value, valueLen);
+        } else if (EQUALS(key, keyLen, "BOOTID.UPNP.ORG")) {
+            bootId=QByteArray(value, valueLen);
+        } else if (EQUALS(key, keyLen, "CONFIGID.UPNP.ORG")) {
+            configId=QByteArray(value, valueLen);
+        } else if (Type_SearchResponse==type ? EQUALS(key, keyLen, "ST") : EQUALS(key, keyLen, "NT")) {
+            target=QByteArray(value, valueLen);
+        } else if (EQUALS(key, keyLen, "CACHE-CONTROL")) {
+            age=maxAge(value, valueLen);
+        } else if (Type_Notify==type && EQUALS(key, keyLen, "NTS")) {
+            if (EQUALS(value, valueLen, "ssdp:byebye")) {
+                nts=Nts_ByeBye;
+            } else if (EQUALS(value, valueLen, "ssdp:alive")) {
+                nts=Nts_Alive;
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,64 @@
+/*
+ * Madrigal
+ *
+ * Copyright (c) 2016 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef UPNP_SSDP_MESSAGE_H
+#define UPNP_SSDP_MESSAGE_H
+
+#include <QByteArray>
+
+namespace Upnp {
+
+/*
+ * The parts of an SSDP search response, or NOTIFY, that Ssdp uses. Headers are located
+ * within the datagram in place - only the values that are kept are copied.
+ */
+struct SsdpMessage {
+    enum Type {
+        Type_Other, // e.g. M-SEARCH requests from other control points
+        Type_SearchResponse,
+        Type_Notify
+    };
+
+    enum Nts {
+        Nts_Other,
+        Nts_Alive,
+        Nts_ByeBye
+    };
+
+    SsdpMessage() : type(Type_Other), nts(Nts_Other), age(0) { }
+    // Returns false, and sets type to Type_Other, if this is not a search response or NOTIFY
+    bool parse(const char *data, int size);
+
+    Type type;
+    Nts nts;
+    int age; // Seconds, from CACHE-CONTROL max-age
+    QByteArray location;
+    QByteArray usn;
+    QByteArray bootId;
+    QByteArray configId;
+    QByteArray target; // ST of a search response, NT of a NOTIFY
+};
+
+}
+
+#endif
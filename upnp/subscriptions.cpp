@@ -0,0 +1,369 @@
+/*
+ * Madrigal
+ *
+ * Copyright (c) 2016 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "upnp/subscriptions.h"
+#include "upnp/device.h"
+#include "core/configuration.h"
+#include "core/globalstatic.h"
+#include "core/debug.h"
+#include <QTimer>
+#if QT_VERSION < 0x050a00
+#include <QDateTime>
+#else
+#include <QRandomGenerator>
+#endif
+
+GLOBAL_STATIC(Upnp::Subscriptions, instance)
+
+// Random value from 0 to range-1
+static int randomInt(int range) {
+    #if QT_VERSION < 0x050a00
+    static bool seeded=false;
+    if (!seeded) {
+        qsrand((uint)QDateTime::currentMSecsSinceEpoch());
+        seeded=true;
+    }
+    return qrand()%range;
+    #else
+    return QRandomGenerator::global()->bounded(range);
+    #endif
+}
+
+static const int constDefaultInterval=16; // ~1 frame at 60Hz
+static const int constReorderTimeout=500; // ms to wait for a missing event
+static const int constResubscribeDelay=2000; // ms before the first re-try, doubled for each subsequent attempt
+static const int constMaxResubscribeDelay=5*60*1000;
+
+// Variables whose changes must not be delayed, or merged
+static bool isUrgent(const Upnp::Properties &props) {
+    foreach (const Upnp::Property &prop, props) {
+        switch (prop.var) {
+        case Upnp::Property::Var_TransportState:
+        case Upnp::Property::Var_SystemUpdateID:
+        case Upnp::Property::Var_ContainerUpdateIDs:
+            return true;
+        default:
+            break;
+        }
+    }
+    return false;
+}
+
+Upnp::Subscriptions::Subscriptions()
+    : timer(0)
+    , gapTimer(new QTimer(this))
+    , renewTimer(new QTimer(this))
+    , received(0)
+    , applied(0)
+{
+    clock.start();
+    gapTimer->setSingleShot(true);
+    connect(gapTimer, SIGNAL(timeout()), this, SLOT(gapTimeout()));
+    renewTimer->setSingleShot(true);
+    connect(renewTimer, SIGNAL(timeout()), this, SLOT(renewTimeout()));
+    int interval=Core::Configuration(this).get("eventInterval", constDefaultInterval, 0, 1000);
+    if (interval>0) {
+        timer=new QTimer(this);
+        timer->setSingleShot(true);
+        timer->setInterval(interval);
+        connect(timer, SIGNAL(timeout()), this, SLOT(applyPending()));
+    }
+}
+
+void Upnp::Subscriptions::add(const QByteArray &sid, Device *dev, const QByteArray &service, quint32 timeout) {
+    // Keep any existing entry, so that sequence IDs are tracked accross subscription renewals.
+    QHash<QByteArray, Subscription>::Iterator it=subscriptions.find(sid);
+    if (it==subscriptions.end() || it.value().device!=dev) {
+        it=subscriptions.insert(sid, Subscription(dev, service));
+    }
+    qint64 renewIn=(qint64)timeout*(50+randomInt(26))*10; // 50-75% of timeout, in ms
+    DBUG(Devices) << sid << dev->uuid() << service << timeout << renewIn;
+    it.value().renewAt=clock.elapsed()+renewIn;
+    startRenewTimer();
+}
+
+void Upnp::Subscriptions::remove(const QByteArray &sid) {
+    subscriptions.remove(sid);
+    pending.remove(sid);
+}
+
+/*
+ * Schedule a fresh subscription to a service. The first attempt is made straight away,
+ * further attempts are delayed - doubling each time, up to constMaxResubscribeDelay.
+ */
+void Upnp::Subscriptions::resubscribe(Device *dev, const QByteArray &service, int attempt) {
+    qint64 delay=0;
+    if (attempt>0) {
+        delay=qMin((qint64)constResubscribeDelay<<qMin(attempt-1, 16), (qint64)constMaxResubscribeDelay);
+    }
+    DBUG(Devices) << dev->uuid() << service << attempt << delay;
+    QList<Resubscribe>::Iterator it=resubscribes.begin();
+    QList<Resubscribe>::Iterator end=resubscribes.end();
+    for (; it!=end; ++it) {
+        if ((*it).device==dev && (*it).service==service) {
+            break;
+        }
+    }
+    if (it==end) {
+        resubscribes.append(Resubscribe(dev, service, attempt, clock.elapsed()+delay));
+    } else {
+        (*it).attempt=attempt;
+        (*it).retryAt=clock.elapsed()+delay;
+    }
+    startRenewTimer();
+}
+
+void Upnp::Subscriptions::cancelResubscribes(Device *dev) {
+    QList<Resubscribe>::Iterator it=resubscribes.begin();
+    while (it!=resubscribes.end()) {
+        if ((*it).device==dev) {
+            it=resubscribes.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void Upnp::Subscriptions::notification(const QByteArray &sid, const Upnp::Properties &props, int seq) {
+    QHash<QByteArray, Subscription>::Iterator it=subscriptions.find(sid);
+    if (it==subscriptions.end() || !it.value().device->isActive()) {
+        DBUG(Devices) << "Unknown subscription" << sid;
+        return;
+    }
+
+    Subscription &sub=it.value();
+    received+=props.count();
+
+    if (0==seq) {
+        // Initial event of a new subscription - this contains all state, so nothing
+        // held back is relevant any more.
+        sub.reorder.clear();
+        sub.gapDeadline=-1;
+    } else if (-1!=sub.lastSeq) {
+        // If we recieve multiple notifications *very* close together, its possible for
+        // them to be read in the wrong order! So, if we a have actioned a new notification,
+        // skip any old ones
+        if (seq<=sub.lastSeq) {
+            return;
+        }
+        if (seq>sub.lastSeq+1) {
+            DBUG(Devices) << "Gap in events" << sid << sub.lastSeq << seq;
+            sub.reorder.insert(seq, props);
+            if (-1==sub.gapDeadline) {
+                sub.gapDeadline=clock.elapsed()+constReorderTimeout;
+                startGapTimer();
+            }
+            return;
+        }
+    }
+    sub.lastSeq=seq;
+    queue(sid, props);
+    applyReordered(sid);
+}
+
+void Upnp::Subscriptions::queue(const QByteArray &sid, const Properties &props) {
+    if (!timer || isUrgent(props)) {
+        // Apply anything older first, so that values are not applied out of order
+        flush(sid);
+        apply(sid, props);
+        return;
+    }
+
+    // Replace any queued value of the same variable, otherwise append.
+    Properties &queued=pending[sid];
+    foreach (const Property &prop, props) {
+        int i=0;
+        for (; i<queued.count(); ++i) {
+            if (queued.at(i).var==prop.var) {
+                queued[i]=prop;
+                break;
+            }
+        }
+        if (i==queued.count()) {
+            queued.append(prop);
+        }
+    }
+    if (!timer->isActive()) {
+        timer->start();
+    }
+}
+
+void Upnp::Subscriptions::applyPending() {
+    // Take a copy, as applying a change might cause a device to (un)subscribe
+    QHash<QByteArray, Properties> toApply=pending;
+    pending.clear();
+    QHash<QByteArray, Properties>::ConstIterator it=toApply.constBegin();
+    QHash<QByteArray, Properties>::ConstIterator end=toApply.constEnd();
+    for (; it!=end; ++it) {
+        apply(it.key(), it.value());
+    }
+    DBUG(Devices) << "Events received:" << received << "applied:" << applied;
+}
+
+void Upnp::Subscriptions::apply(const QByteArray &sid, const Properties &props) {
+    QHash<QByteArray, Subscription>::ConstIterator it=subscriptions.constFind(sid);
+    if (it!=subscriptions.constEnd() && it.value().device->isActive()) {
+        applied+=props.count();
+        it.value().device->notification(sid, props);
+    }
+}
+
+/*
+ * Apply any held back events that now follow on from the last applied sequence number.
+ */
+void Upnp::Subscriptions::applyReordered(const QByteArray &sid) {
+    forever {
+        // Lookup each time, as applying an event might (un)subscribe
+        QHash<QByteArray, Subscription>::Iterator it=subscriptions.find(sid);
+        if (it==subscriptions.end() || it.value().reorder.isEmpty()) {
+            return;
+        }
+        Subscription &sub=it.value();
+        QMap<int, Properties>::Iterator first=sub.reorder.begin();
+        if (first.key()!=sub.lastSeq+1) {
+            return;
+        }
+        Properties props=first.value();
+        sub.lastSeq=first.key();
+        sub.reorder.erase(first);
+        if (sub.reorder.isEmpty()) {
+            sub.gapDeadline=-1;
+        }
+        queue(sid, props);
+    }
+}
+
+void Upnp::Subscriptions::gapTimeout() {
+    qint64 now=clock.elapsed();
+    QList<QByteArray> expired;
+    QHash<QByteArray, Subscription>::ConstIterator it=subscriptions.constBegin();
+    QHash<QByteArray, Subscription>::ConstIterator end=subscriptions.constEnd();
+    for (; it!=end; ++it) {
+        if (-1!=it.value().gapDeadline && it.value().gapDeadline<=now) {
+            expired.append(it.key());
+        }
+    }
+
+    foreach (const QByteArray &sid, expired) {
+        QHash<QByteArray, Subscription>::Iterator sub=subscriptions.find(sid);
+        if (sub==subscriptions.end()) {
+            continue;
+        }
+        // Missing event(s) did not arrive, so apply what we have and then ask
+        // the device for the current state of this service.
+        QMap<int, Properties> held=sub.value().reorder;
+        Device *dev=sub.value().device;
+        QByteArray service=sub.value().service;
+        DBUG(Devices) << "Missed events" << sid << sub.value().lastSeq << held.firstKey();
+        sub.value().reorder.clear();
+        sub.value().gapDeadline=-1;
+        sub.value().lastSeq=held.lastKey();
+        foreach (const Properties &props, held) {
+            queue(sid, props);
+        }
+        if (subscriptions.contains(sid) && dev->isActive()) {
+            flush(sid);
+            dev->resync(service);
+        }
+    }
+    startGapTimer();
+}
+
+void Upnp::Subscriptions::startGapTimer() {
+    qint64 next=-1;
+    QHash<QByteArray, Subscription>::ConstIterator it=subscriptions.constBegin();
+    QHash<QByteArray, Subscription>::ConstIterator end=subscriptions.constEnd();
+    for (; it!=end; ++it) {
+        if (-1!=it.value().gapDeadline && (-1==next || it.value().gapDeadline<next)) {
+            next=it.value().gapDeadline;
+        }
+    }
+    if (-1==next) {
+        gapTimer->stop();
+    } else {
+        gapTimer->start((int)qMax((qint64)0, next-clock.elapsed()));
+    }
+}
+
+void Upnp::Subscriptions::renewTimeout() {
+    qint64 now=clock.elapsed();
+    QList<QPair<Device *, QByteArray> > due;
+    QHash<QByteArray, Subscription>::Iterator it=subscriptions.begin();
+    QHash<QByteArray, Subscription>::Iterator end=subscriptions.end();
+    for (; it!=end; ++it) {
+        if (-1!=it.value().renewAt && it.value().renewAt<=now) {
+            // Rescheduled when the device responds
+            it.value().renewAt=-1;
+            due.append(qMakePair(it.value().device, it.value().service));
+        }
+    }
+
+    QList<Resubscribe> retry;
+    QList<Resubscribe>::Iterator rit=resubscribes.begin();
+    while (rit!=resubscribes.end()) {
+        if ((*rit).retryAt<=now) {
+            retry.append(*rit);
+            rit=resubscribes.erase(rit);
+        } else {
+            ++rit;
+        }
+    }
+
+    for (int i=0; i<due.count(); ++i) {
+        due.at(i).first->renewSubscription(due.at(i).second);
+    }
+    foreach (const Resubscribe &r, retry) {
+        r.device->resubscribe(r.service, r.attempt+1);
+    }
+    startRenewTimer();
+}
+
+void Upnp::Subscriptions::startRenewTimer() {
+    qint64 next=-1;
+    QHash<QByteArray, Subscription>::ConstIterator it=subscriptions.constBegin();
+    QHash<QByteArray, Subscription>::ConstIterator end=subscriptions.constEnd();
+    for (; it!=end; ++it) {
+        if (-1!=it.value().renewAt && (-1==next || it.value().renewAt<next)) {
+            next=it.value().renewAt;
+        }
+    }
+    foreach (const Resubscribe &r, resubscribes) {
+        if (-1==next || r.retryAt<next) {
+            next=r.retryAt;
+        }
+    }
+    if (-1==next) {
+        renewTimer->stop();
+    } else {
+        renewTimer->start((int)qMax((qint64)0, next-clock.elapsed()));
+    }
+}
+
+void Upnp::Subscriptions::flush(const QByteArray &sid) {
+    QHash<QByteArray, Properties>::Iterator it=pending.find(sid);
+    if (it!=pending.end()) {
+        Properties props=it.value();
+        pending.erase(it);
+        apply(sid, props);
+    }
+}
@@ -0,0 +1,115 @@
+/*
+ * Madrigal
+ *
+ * Copyright (c) 2016 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef UPNP_SUBSCRIPTIONS_H
+#define UPNP_SUBSCRIPTIONS_H
+
+#include "upnp/property.h"
+#include <QObject>
+#include <QHash>
+#include <QMap>
+#include <QElapsedTimer>
+
+class QTimer;
+
+namespace Upnp {
+
+class Device;
+
+/*
+ * Maps event subscription IDs to the device, and service, that requested them. Incoming
+ * events are dispatched directly to the owning device.
+ *
+ * Rapidly changing variables (e.g. Seconds, IdArray) are coalesced, so that only their
+ * latest value is applied once per interval.
+ *
+ * Events that arrive ahead of a missing sequence number are held back for a short time.
+ * If the gap is not filled, the held events are applied and the device is asked to
+ * re-query the state of the affected service.
+ *
+ * Each subscription is renewed at a random point between 50% and 75% of the lifetime
+ * granted by the device, so that renewals for many devices are spread out. Services
+ * that could not be subscribed to afresh are re-tried, with an increasing delay.
+ */
+class Subscriptions : public QObject {
+    Q_OBJECT
+
+public:
+    struct Subscription {
+        Subscription(Device *d=0, const QByteArray &s=QByteArray()) : device(d), service(s), lastSeq(-1), gapDeadline(-1), renewAt(-1) { }
+        Device *device;
+        QByteArray service;
+        int lastSeq;
+        QMap<int, Properties> reorder; // Events received ahead of a gap, keyed on SEQ
+        qint64 gapDeadline;
+        qint64 renewAt;
+    };
+
+    struct Resubscribe {
+        Resubscribe(Device *d=0, const QByteArray &s=QByteArray(), int a=0, qint64 at=-1) : device(d), service(s), attempt(a), retryAt(at) { }
+        Device *device;
+        QByteArray service;
+        int attempt;
+        qint64 retryAt;
+    };
+
+    static Subscriptions * self();
+
+    Subscriptions();
+    void add(const QByteArray &sid, Device *dev, const QByteArray &service, quint32 timeout);
+    void remove(const QByteArray &sid);
+    void resubscribe(Device *dev, const QByteArray &service, int attempt);
+    void cancelResubscribes(Device *dev);
+
+public Q_SLOTS:
+    void notification(const QByteArray &sid, const Upnp::Properties &props, int seq);
+
+private Q_SLOTS:
+    void applyPending();
+    void gapTimeout();
+    void renewTimeout();
+
+private:
+    void queue(const QByteArray &sid, const Properties &props);
+    void apply(const QByteArray &sid, const Properties &props);
+    void flush(const QByteArray &sid);
+    void applyReordered(const QByteArray &sid);
+    void startGapTimer();
+    void startRenewTimer();
+
+private:
+    QHash<QByteArray, Subscription> subscriptions;
+    QHash<QByteArray, Properties> pending;
+    QList<Resubscribe> resubscribes;
+    QTimer *timer;
+    QTimer *gapTimer;
+    QTimer *renewTimer;
+    QElapsedTimer clock;
+    // Evented variables received, and applied after coalescing - reported in the debug output
+    quint64 received;
+    quint64 applied;
+};
+
+}
+
+#endif